@@ -0,0 +1,293 @@
+/*
+*******************************************************************************
+    ChenKe404's text library
+*******************************************************************************
+@project	cktext
+@authors	chenke404
+@file	cktextd.cpp
+@brief 	translation daemon keeping catalogs resident
+
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 chenke404
+******************************************************************************
+*/
+
+
+/*
+ * cktextd [-m mode] [-c connections] [-b bytes] [-e entries] [-g groups] [-M memory] <socket> <root>
+ * 常驻的翻译守护进程, 目录只在第一次被请求时加载, 之后以只读映像发布在共享内存中供所有客户端附加
+ * 只能加载root目录下的目录文件, 相对路径相对于root
+ * -m 共享内存的访问权限(八进制), 默认0600
+ * -c 同时连接的客户端上限, 默认64
+ * -b -e -g -M 加载每个目录的限制, 见Text::Limits, 0表示不限制
+ *    默认解压后最多256MB, 翻译项的估算内存占用最多256MB
+ * 协议见client.h
+ */
+
+#include "client.h"
+
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <filesystem>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace fs = std::filesystem;
+using namespace ck;
+
+struct Catalog
+{
+    std::string path;
+    std::string shm;    // 共享内存名称
+    Image image;        // 守护进程自己附加的映像, 用于批量查询
+};
+
+static std::mutex g_mtx;
+static std::vector<std::unique_ptr<Catalog>> g_catalogs;
+static volatile sig_atomic_t g_quit = 0;
+static fs::path g_root;             // 目录文件所在的根目录
+static unsigned g_mode = 0600;      // 共享内存的访问权限
+static Text::Limits g_limits;       // 加载目录的限制, 目录由客户端指定, 不能信任
+static std::atomic<uint32_t> g_connections { 0 };
+
+// 已加载的目录, 需要持有g_mtx
+static Catalog* find_catalog(const std::string& path, uint32_t& id)
+{
+    for(size_t i = 0; i < g_catalogs.size(); ++i)
+    {
+        if(g_catalogs[i]->path == path)
+        {
+            id = (uint32_t)i;
+            return g_catalogs[i].get();
+        }
+    }
+    return nullptr;
+}
+
+// 加载目录, 已加载过的直接返回
+static Catalog* open_catalog(const std::string& filename, uint32_t& id)
+{
+    // 解析符号链接后必须仍在根目录下
+    std::error_code ec;
+    const auto canonical = fs::canonical(g_root / filename, ec);
+    if(ec)
+    {
+        std::cerr << "cktextd: can't find catalog:" << filename << std::endl;
+        return nullptr;
+    }
+    const auto rel = canonical.lexically_relative(g_root);
+    if(rel.empty() || *rel.begin() == "..")
+    {
+        std::cerr << "cktextd: catalog is outside the root:" << filename << std::endl;
+        return nullptr;
+    }
+    const auto path = canonical.string();
+
+    {
+        std::lock_guard<std::mutex> lock(g_mtx);
+        if(auto cat = find_catalog(path, id))
+            return cat;
+    }
+
+    // 加载和发布不持有锁, 不阻塞其他连接的查询
+    static std::atomic<uint32_t> serial { 0 };
+    Text text;
+    if(!text.open(path.c_str(), g_limits))
+    {
+        std::cerr << "cktextd: can't open catalog:" << path << std::endl;
+        return nullptr;
+    }
+    auto cat = std::make_unique<Catalog>();
+    cat->path = path;
+    cat->shm = "/cktextd." + std::to_string(getpid()) + "." + std::to_string(serial++);
+    if(!Image::publish(cat->shm.c_str(), text, g_mode) || !cat->image.open_shared(cat->shm.c_str()))
+    {
+        std::cerr << "cktextd: can't publish catalog:" << path << std::endl;
+        Image::unpublish(cat->shm.c_str());
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(g_mtx);
+    // 其他连接同时加载了同一个目录
+    if(auto ret = find_catalog(path, id))
+    {
+        Image::unpublish(cat->shm.c_str());
+        return ret;
+    }
+    id = (uint32_t)g_catalogs.size();
+    g_catalogs.push_back(std::move(cat));
+    return g_catalogs.back().get();
+}
+
+static Catalog* get_catalog(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(g_mtx);
+    return id < g_catalogs.size() ? g_catalogs[id].get() : nullptr;
+}
+
+static bool lookup(const std::vector<uint8_t>& data, std::vector<uint8_t>& out)
+{
+    if(data.size() < 8)
+        return false;
+    uint32_t id = 0, count = 0;
+    memcpy(&id, data.data(), 4);
+    memcpy(&count, data.data() + 4, 4);
+    auto cat = get_catalog(id);
+    if(!cat || count > (data.size() - 8) / 4)
+        return false;
+
+    out.resize((size_t)count * 8);
+    std::string src;
+    size_t pos = 8;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t sz = 0;
+        if(data.size() - pos < 4)
+            return false;
+        memcpy(&sz, data.data() + pos, 4);
+        pos += 4;
+        if(data.size() - pos < sz)
+            return false;
+        src.assign((const char*)data.data() + pos, sz);
+        pos += sz;
+
+        const auto ofs = cat->image.offset(src.c_str());
+        const uint64_t v = ofs == SIZE_MAX ? UINT64_MAX : ofs;
+        memcpy(out.data() + (size_t)i * 8, &v, 8);
+    }
+    return true;
+}
+
+static void serve(int fd)
+{
+    Client::head hd {};
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> out;
+    while(!g_quit && Client::recv(fd, hd, data))
+    {
+        bool ok = false;
+        out.clear();
+        switch(hd.op)
+        {
+        case Client::OP_OPEN:
+        {
+            uint32_t id = 0;
+            const std::string filename(data.begin(), data.end());
+            if(auto cat = open_catalog(filename, id))
+            {
+                out.resize(4);
+                memcpy(out.data(), &id, 4);
+                out.insert(out.end(), cat->shm.begin(), cat->shm.end());
+                ok = true;
+            }
+        }
+        break;
+        case Client::OP_LOOKUP:
+            ok = lookup(data, out);
+            break;
+        default: break;
+        }
+        if(!ok) out.clear();
+        if(!Client::send(fd, ok ? 0 : 1, out.data(), (uint32_t)out.size()))
+            break;
+    }
+    close(fd);
+    --g_connections;
+}
+
+static void on_signal(int)
+{
+    g_quit = 1;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t max_connections = 64;
+    g_limits.max_bytes = 256 << 20;
+    g_limits.max_memory = 256 << 20;
+    int i = 1;
+    for(; i + 1 < argc && argv[i][0] == '-'; i += 2)
+    {
+        if(!strcmp(argv[i], "-m"))
+            g_mode = (unsigned)strtoul(argv[i + 1], nullptr, 8) & 0777;
+        else if(!strcmp(argv[i], "-c"))
+            max_connections = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+        else if(!strcmp(argv[i], "-b"))
+            g_limits.max_bytes = (size_t)strtoull(argv[i + 1], nullptr, 10);
+        else if(!strcmp(argv[i], "-e"))
+            g_limits.max_entries = (size_t)strtoull(argv[i + 1], nullptr, 10);
+        else if(!strcmp(argv[i], "-g"))
+            g_limits.max_groups = (size_t)strtoull(argv[i + 1], nullptr, 10);
+        else if(!strcmp(argv[i], "-M"))
+            g_limits.max_memory = (size_t)strtoull(argv[i + 1], nullptr, 10);
+        else
+            break;
+    }
+    if(argc - i != 2 || max_connections < 1)
+    {
+        std::cerr << "usage: cktextd [-m mode] [-c connections] [-b bytes] [-e entries] [-g groups] [-M memory] <socket> <root>" << std::endl;
+        return 1;
+    }
+    const char* path = argv[i];
+    std::error_code ec;
+    g_root = fs::canonical(argv[i + 1], ec);
+    if(ec || !fs::is_directory(g_root))
+    {
+        std::cerr << "cktextd: root is not a directory:" << argv[i + 1] << std::endl;
+        return 1;
+    }
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        std::cerr << "cktextd: socket path is too long:" << path << std::endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if(fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0)
+    {
+        std::cerr << "cktextd: can't listen on:" << path << std::endl;
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // 每个连接一个线程, 目录加载后只读, 查询不需要加锁
+    // 每个连接最多缓存MAX_MESSAGE大小的消息, 超过连接上限时直接关闭新的连接
+    pollfd pfd { fd,POLLIN,0 };
+    while(!g_quit)
+    {
+        if(poll(&pfd, 1, 500) <= 0)
+            continue;
+        const int cfd = accept(fd, nullptr, nullptr);
+        if(cfd < 0)
+            continue;
+        if(g_connections >= max_connections)
+        {
+            std::cerr << "cktextd: too many connections! rejected." << std::endl;
+            close(cfd);
+            continue;
+        }
+        ++g_connections;
+        std::thread(serve, cfd).detach();
+    }
+
+    close(fd);
+    unlink(path);
+    std::lock_guard<std::mutex> lock(g_mtx);
+    for(auto& it : g_catalogs)
+        Image::unpublish(it->shm.c_str());
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+*******************************************************************************
+    ChenKe404's text library
+*******************************************************************************
+@project	cktext
+@authors	chenke404
+@file	client.cpp
+@brief 	client of the cktextd translation daemon
+
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 chenke404
+******************************************************************************
+*/
+
+
+#include "client.h"
+
+#include <iostream>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace ck
+{
+
+#ifndef _WIN32
+static bool write_all(int fd, const void* data, size_t size)
+{
+    auto ptr = (const uint8_t*)data;
+    while(size > 0)
+    {
+        const auto ret = ::send(fd, ptr, size, MSG_NOSIGNAL);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return false;
+        ptr += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void* data, size_t size)
+{
+    auto ptr = (uint8_t*)data;
+    while(size > 0)
+    {
+        const auto ret = ::recv(fd, ptr, size, 0);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return false;
+        ptr += ret;
+        size -= ret;
+    }
+    return true;
+}
+#endif
+
+bool Client::send(int fd, uint32_t op, const void* data, uint32_t size)
+{
+#ifdef _WIN32
+    return false;
+#else
+    head hd { op,size };
+    return write_all(fd, &hd, sizeof(hd)) && (size == 0 || write_all(fd, data, size));
+#endif
+}
+
+bool Client::recv(int fd, head& hd, std::vector<uint8_t>& data)
+{
+#ifdef _WIN32
+    return false;
+#else
+    if(!read_all(fd, &hd, sizeof(hd)) || hd.size > MAX_MESSAGE)
+        return false;
+    data.resize(hd.size);
+    return hd.size == 0 || read_all(fd, data.data(), hd.size);
+#endif
+}
+
+Client::~Client()
+{
+    close();
+}
+
+bool Client::open(const char* socket, const char* filename)
+{
+    close();
+#ifdef _WIN32
+    std::cerr << "Client::open: unix domain socket is not supported on this platform!" << std::endl;
+    return false;
+#else
+    if(!socket || !filename) return false;
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if(strlen(socket) >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Client::open: socket path is too long:" << socket << std::endl;
+        return false;
+    }
+    strcpy(addr.sun_path, socket);
+
+    _fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(_fd < 0)
+        return false;
+    if(::connect(_fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        std::cerr << "Client::open: can't connect to daemon:" << socket << std::endl;
+        close();
+        return false;
+    }
+
+    // 请求守护进程加载目录, 应答中带有共享内存的名称
+    head hd {};
+    std::vector<uint8_t> data;
+    if(!send(_fd, OP_OPEN, filename, (uint32_t)strlen(filename)) || !recv(_fd, hd, data))
+    {
+        close();
+        return false;
+    }
+    if(hd.op != 0 || data.size() < 5)
+    {
+        std::cerr << "Client::open: daemon can't open catalog:" << filename << std::endl;
+        close();
+        return false;
+    }
+    memcpy(&_catalog, data.data(), 4);
+    const std::string name((const char*)data.data() + 4, data.size() - 4);
+    if(!_image.open_shared(name.c_str()))
+    {
+        std::cerr << "Client::open: can't attach shared memory:" << name << std::endl;
+        close();
+        return false;
+    }
+    return true;
+#endif
+}
+
+void Client::close()
+{
+#ifndef _WIN32
+    if(_fd >= 0)
+        ::close(_fd);
+#endif
+    _fd = -1;
+    _catalog = 0;
+    _image.close();
+}
+
+bool Client::valid() const
+{
+    return _fd >= 0 && _image.valid();
+}
+
+Client::u8str Client::u8(u8str src, u8str def) const
+{
+    return _image.u8(src, def);
+}
+
+bool Client::u8(const u8str* src, size_t count, u8str* out, u8str def) const
+{
+    if(!valid() || count > UINT32_MAX)
+        return false;
+    if(count == 0)
+        return true;
+
+    std::vector<uint8_t> data(8);
+    auto sz = (uint32_t)count;
+    memcpy(data.data(), &_catalog, 4);
+    memcpy(data.data() + 4, &sz, 4);
+    for(size_t i = 0; i < count; ++i)
+    {
+        sz = src[i] ? (uint32_t)strlen(src[i]) : 0;
+        const auto pos = data.size();
+        data.resize(pos + 4 + sz);
+        memcpy(data.data() + pos, &sz, 4);
+        if(sz > 0)
+            memcpy(data.data() + pos + 4, src[i], sz);
+    }
+    if(data.size() > MAX_MESSAGE)
+    {
+        std::cerr << "Client::u8: too many sources in one batch!" << std::endl;
+        return false;
+    }
+
+    head hd {};
+    if(!send(_fd, OP_LOOKUP, data.data(), (uint32_t)data.size()) || !recv(_fd, hd, data))
+        return false;
+    if(hd.op != 0 || data.size() != count * 8)
+        return false;
+
+    // 应答是译文在共享映像中的偏移
+    const auto base = (const char*)_image.data();
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint64_t ofs = 0;
+        memcpy(&ofs, data.data() + i * 8, 8);
+        if(ofs == 0 || ofs == UINT64_MAX || ofs >= _image.size())
+            out[i] = def;
+        else
+            out[i] = base + ofs;
+    }
+    return true;
+}
+
+}
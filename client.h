@@ -0,0 +1,84 @@
+/*
+*******************************************************************************
+    ChenKe404's text library
+*******************************************************************************
+@project	cktext
+@authors	chenke404
+@file	client.h
+@brief 	client of the cktextd translation daemon
+
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 chenke404
+******************************************************************************
+*/
+
+
+#ifndef CK_CLIENT_H
+#define CK_CLIENT_H
+
+/*
+ * cktextd守护进程的客户端
+ * 守护进程常驻并持有已加载的目录, 每个目录以只读映像发布在共享内存中
+ * 客户端通过Unix域套接字请求打开目录并附加其共享内存, 批量查询的结果是译文在共享映像中的偏移,
+ * 客户端直接从共享内存读取译文, 不需要拷贝
+ * 只在POSIX平台上有效
+ */
+
+#include "image.h"
+
+namespace ck
+{
+
+struct Client
+{
+    using u8str = Text::u8str;
+
+    // 协议: 请求和应答都以head开头, 后跟size字节的数据
+    struct head
+    {
+        uint32_t op;    // 请求时为操作码, 应答时为状态码(0为成功)
+        uint32_t size;
+    };
+
+    enum Op
+    {
+        OP_OPEN = 1,    // 数据: 目录文件路径; 应答: 目录编号(4字节) + 共享内存名称
+        OP_LOOKUP = 2,  // 数据: 目录编号(4字节) + 原文个数(4字节) + 每个原文(4字节长度+内容); 应答: 每个原文8字节的偏移, 同Image::offset
+    };
+
+    // 单个消息的最大数据长度
+    static constexpr uint32_t MAX_MESSAGE = 64 << 20;
+
+    // 发送一条消息
+    static bool send(int fd, uint32_t op, const void* data, uint32_t size);
+    // 接收一条消息, 数据超过MAX_MESSAGE视为失败
+    static bool recv(int fd, head& hd, std::vector<uint8_t>& data);
+
+    Client() = default;
+    Client(const Client&) = delete;
+    ~Client();
+
+    // 连接守护进程并打开目录
+    // @socket 守护进程监听的套接字路径
+    // @filename 目录文件路径, 由守护进程加载
+    bool open(const char* socket, const char* filename);
+    void close();
+    bool valid() const;
+
+    // 获取第一个匹配的译文, 直接在共享映像中查询
+    // @def 译文不存在时的返回值
+    // @return utf8译文 或 def(原文或译文不存在)
+    u8str u8(u8str src, u8str def = nullptr) const;
+
+    // 批量查询, 由守护进程完成查找, 一次往返得到全部结果
+    // @out 长度为count的结果数组, 含义同u8的返回值
+    bool u8(const u8str* src, size_t count, u8str* out, u8str def = nullptr) const;
+private:
+    int _fd = -1;
+    uint32_t _catalog = 0;
+    Image _image;
+};
+
+}
+
+#endif // !CK_CLIENT_H
@@ -0,0 +1,233 @@
+/*
+*******************************************************************************
+    ChenKe404's text library
+*******************************************************************************
+@project	cktext
+@authors	chenke404
+@file	fold.cpp
+@brief 	NFC composition and simple case folding of source strings
+
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 chenke404
+******************************************************************************
+*/
+
+
+/*
+ * 只覆盖常用的部分: 拉丁, 希腊, 西里尔字母的组合与大小写, 以及谚文音节的组合
+ * 表格由Unicode 14.0数据生成
+ * 组合只与前一个字符进行, 不做规范重排序, 组合符号按常见顺序书写时结果与NFC相同
+ */
+
+#include "text.h"
+
+#include <algorithm>
+
+namespace ck
+{
+
+struct fold_range
+{
+    uint16_t first;
+    uint16_t last;
+    int16_t delta;
+    uint16_t stride;
+};
+
+struct compose_item
+{
+    uint16_t base;
+    uint16_t mark;
+    uint16_t result;
+};
+
+// 简单大小写折叠, 每项为 {首码点, 末码点, 差值, 步长}, 区间内按步长间隔的码点加上差值
+static const fold_range g_fold[] = {
+    {0x0041,0x005A,32,1},{0x00B5,0x00B5,775,1},{0x00C0,0x00D6,32,1},{0x00D8,0x00DE,32,1},
+    {0x0100,0x012E,1,2},{0x0132,0x0136,1,2},{0x0139,0x0147,1,2},{0x014A,0x0176,1,2},
+    {0x0178,0x0178,-121,1},{0x0179,0x017D,1,2},{0x017F,0x017F,-268,1},{0x0181,0x0181,210,1},
+    {0x0182,0x0184,1,2},{0x0186,0x0186,206,1},{0x0187,0x0187,1,1},{0x0189,0x018A,205,1},
+    {0x018B,0x018B,1,1},{0x018E,0x018E,79,1},{0x018F,0x018F,202,1},{0x0190,0x0190,203,1},
+    {0x0191,0x0191,1,1},{0x0193,0x0193,205,1},{0x0194,0x0194,207,1},{0x0196,0x0196,211,1},
+    {0x0197,0x0197,209,1},{0x0198,0x0198,1,1},{0x019C,0x019C,211,1},{0x019D,0x019D,213,1},
+    {0x019F,0x019F,214,1},{0x01A0,0x01A4,1,2},{0x01A6,0x01A6,218,1},{0x01A7,0x01A7,1,1},
+    {0x01A9,0x01A9,218,1},{0x01AC,0x01AC,1,1},{0x01AE,0x01AE,218,1},{0x01AF,0x01AF,1,1},
+    {0x01B1,0x01B2,217,1},{0x01B3,0x01B5,1,2},{0x01B7,0x01B7,219,1},{0x01B8,0x01B8,1,1},
+    {0x01BC,0x01BC,1,1},{0x01C4,0x01C4,2,1},{0x01C5,0x01C5,1,1},{0x01C7,0x01C7,2,1},
+    {0x01C8,0x01C8,1,1},{0x01CA,0x01CA,2,1},{0x01CB,0x01DB,1,2},{0x01DE,0x01EE,1,2},
+    {0x01F1,0x01F1,2,1},{0x01F2,0x01F4,1,2},{0x01F6,0x01F6,-97,1},{0x01F7,0x01F7,-56,1},
+    {0x01F8,0x021E,1,2},{0x0220,0x0220,-130,1},{0x0222,0x0232,1,2},{0x023A,0x023A,10795,1},
+    {0x023B,0x023B,1,1},{0x023D,0x023D,-163,1},{0x023E,0x023E,10792,1},{0x0241,0x0241,1,1},
+    {0x0243,0x0243,-195,1},{0x0244,0x0244,69,1},{0x0245,0x0245,71,1},{0x0246,0x024E,1,2},
+    {0x0345,0x0345,116,1},{0x0370,0x0372,1,2},{0x0376,0x0376,1,1},{0x037F,0x037F,116,1},
+    {0x0386,0x0386,38,1},{0x0388,0x038A,37,1},{0x038C,0x038C,64,1},{0x038E,0x038F,63,1},
+    {0x0391,0x03A1,32,1},{0x03A3,0x03AB,32,1},{0x03C2,0x03C2,1,1},{0x03CF,0x03CF,8,1},
+    {0x03D0,0x03D0,-30,1},{0x03D1,0x03D1,-25,1},{0x03D5,0x03D5,-15,1},{0x03D6,0x03D6,-22,1},
+    {0x03D8,0x03EE,1,2},{0x03F0,0x03F0,-54,1},{0x03F1,0x03F1,-48,1},{0x03F4,0x03F4,-60,1},
+    {0x03F5,0x03F5,-64,1},{0x03F7,0x03F7,1,1},{0x03F9,0x03F9,-7,1},{0x03FA,0x03FA,1,1},
+    {0x03FD,0x03FF,-130,1},{0x0400,0x040F,80,1},{0x0410,0x042F,32,1},{0x0460,0x0480,1,2},
+    {0x048A,0x04BE,1,2},{0x04C0,0x04C0,15,1},{0x04C1,0x04CD,1,2},{0x04D0,0x052E,1,2},
+    {0x1E00,0x1E94,1,2},{0x1E9B,0x1E9B,-58,1},{0x1EA0,0x1EFE,1,2},
+};
+
+// 规范组合, 每项为 {基字符, 组合符号, 组合后的字符}, 按前两项排序
+static const compose_item g_compose[] = {
+    {0x0041,0x0300,0x00C0},{0x0041,0x0301,0x00C1},{0x0041,0x0302,0x00C2},{0x0041,0x0303,0x00C3},{0x0041,0x0304,0x0100},{0x0041,0x0306,0x0102},
+    {0x0041,0x0307,0x0226},{0x0041,0x0308,0x00C4},{0x0041,0x0309,0x1EA2},{0x0041,0x030A,0x00C5},{0x0041,0x030C,0x01CD},{0x0041,0x030F,0x0200},
+    {0x0041,0x0311,0x0202},{0x0041,0x0323,0x1EA0},{0x0041,0x0325,0x1E00},{0x0041,0x0328,0x0104},{0x0042,0x0307,0x1E02},{0x0042,0x0323,0x1E04},
+    {0x0042,0x0331,0x1E06},{0x0043,0x0301,0x0106},{0x0043,0x0302,0x0108},{0x0043,0x0307,0x010A},{0x0043,0x030C,0x010C},{0x0043,0x0327,0x00C7},
+    {0x0044,0x0307,0x1E0A},{0x0044,0x030C,0x010E},{0x0044,0x0323,0x1E0C},{0x0044,0x0327,0x1E10},{0x0044,0x032D,0x1E12},{0x0044,0x0331,0x1E0E},
+    {0x0045,0x0300,0x00C8},{0x0045,0x0301,0x00C9},{0x0045,0x0302,0x00CA},{0x0045,0x0303,0x1EBC},{0x0045,0x0304,0x0112},{0x0045,0x0306,0x0114},
+    {0x0045,0x0307,0x0116},{0x0045,0x0308,0x00CB},{0x0045,0x0309,0x1EBA},{0x0045,0x030C,0x011A},{0x0045,0x030F,0x0204},{0x0045,0x0311,0x0206},
+    {0x0045,0x0323,0x1EB8},{0x0045,0x0327,0x0228},{0x0045,0x0328,0x0118},{0x0045,0x032D,0x1E18},{0x0045,0x0330,0x1E1A},{0x0046,0x0307,0x1E1E},
+    {0x0047,0x0301,0x01F4},{0x0047,0x0302,0x011C},{0x0047,0x0304,0x1E20},{0x0047,0x0306,0x011E},{0x0047,0x0307,0x0120},{0x0047,0x030C,0x01E6},
+    {0x0047,0x0327,0x0122},{0x0048,0x0302,0x0124},{0x0048,0x0307,0x1E22},{0x0048,0x0308,0x1E26},{0x0048,0x030C,0x021E},{0x0048,0x0323,0x1E24},
+    {0x0048,0x0327,0x1E28},{0x0048,0x032E,0x1E2A},{0x0049,0x0300,0x00CC},{0x0049,0x0301,0x00CD},{0x0049,0x0302,0x00CE},{0x0049,0x0303,0x0128},
+    {0x0049,0x0304,0x012A},{0x0049,0x0306,0x012C},{0x0049,0x0307,0x0130},{0x0049,0x0308,0x00CF},{0x0049,0x0309,0x1EC8},{0x0049,0x030C,0x01CF},
+    {0x0049,0x030F,0x0208},{0x0049,0x0311,0x020A},{0x0049,0x0323,0x1ECA},{0x0049,0x0328,0x012E},{0x0049,0x0330,0x1E2C},{0x004A,0x0302,0x0134},
+    {0x004B,0x0301,0x1E30},{0x004B,0x030C,0x01E8},{0x004B,0x0323,0x1E32},{0x004B,0x0327,0x0136},{0x004B,0x0331,0x1E34},{0x004C,0x0301,0x0139},
+    {0x004C,0x030C,0x013D},{0x004C,0x0323,0x1E36},{0x004C,0x0327,0x013B},{0x004C,0x032D,0x1E3C},{0x004C,0x0331,0x1E3A},{0x004D,0x0301,0x1E3E},
+    {0x004D,0x0307,0x1E40},{0x004D,0x0323,0x1E42},{0x004E,0x0300,0x01F8},{0x004E,0x0301,0x0143},{0x004E,0x0303,0x00D1},{0x004E,0x0307,0x1E44},
+    {0x004E,0x030C,0x0147},{0x004E,0x0323,0x1E46},{0x004E,0x0327,0x0145},{0x004E,0x032D,0x1E4A},{0x004E,0x0331,0x1E48},{0x004F,0x0300,0x00D2},
+    {0x004F,0x0301,0x00D3},{0x004F,0x0302,0x00D4},{0x004F,0x0303,0x00D5},{0x004F,0x0304,0x014C},{0x004F,0x0306,0x014E},{0x004F,0x0307,0x022E},
+    {0x004F,0x0308,0x00D6},{0x004F,0x0309,0x1ECE},{0x004F,0x030B,0x0150},{0x004F,0x030C,0x01D1},{0x004F,0x030F,0x020C},{0x004F,0x0311,0x020E},
+    {0x004F,0x031B,0x01A0},{0x004F,0x0323,0x1ECC},{0x004F,0x0328,0x01EA},{0x0050,0x0301,0x1E54},{0x0050,0x0307,0x1E56},{0x0052,0x0301,0x0154},
+    {0x0052,0x0307,0x1E58},{0x0052,0x030C,0x0158},{0x0052,0x030F,0x0210},{0x0052,0x0311,0x0212},{0x0052,0x0323,0x1E5A},{0x0052,0x0327,0x0156},
+    {0x0052,0x0331,0x1E5E},{0x0053,0x0301,0x015A},{0x0053,0x0302,0x015C},{0x0053,0x0307,0x1E60},{0x0053,0x030C,0x0160},{0x0053,0x0323,0x1E62},
+    {0x0053,0x0326,0x0218},{0x0053,0x0327,0x015E},{0x0054,0x0307,0x1E6A},{0x0054,0x030C,0x0164},{0x0054,0x0323,0x1E6C},{0x0054,0x0326,0x021A},
+    {0x0054,0x0327,0x0162},{0x0054,0x032D,0x1E70},{0x0054,0x0331,0x1E6E},{0x0055,0x0300,0x00D9},{0x0055,0x0301,0x00DA},{0x0055,0x0302,0x00DB},
+    {0x0055,0x0303,0x0168},{0x0055,0x0304,0x016A},{0x0055,0x0306,0x016C},{0x0055,0x0308,0x00DC},{0x0055,0x0309,0x1EE6},{0x0055,0x030A,0x016E},
+    {0x0055,0x030B,0x0170},{0x0055,0x030C,0x01D3},{0x0055,0x030F,0x0214},{0x0055,0x0311,0x0216},{0x0055,0x031B,0x01AF},{0x0055,0x0323,0x1EE4},
+    {0x0055,0x0324,0x1E72},{0x0055,0x0328,0x0172},{0x0055,0x032D,0x1E76},{0x0055,0x0330,0x1E74},{0x0056,0x0303,0x1E7C},{0x0056,0x0323,0x1E7E},
+    {0x0057,0x0300,0x1E80},{0x0057,0x0301,0x1E82},{0x0057,0x0302,0x0174},{0x0057,0x0307,0x1E86},{0x0057,0x0308,0x1E84},{0x0057,0x0323,0x1E88},
+    {0x0058,0x0307,0x1E8A},{0x0058,0x0308,0x1E8C},{0x0059,0x0300,0x1EF2},{0x0059,0x0301,0x00DD},{0x0059,0x0302,0x0176},{0x0059,0x0303,0x1EF8},
+    {0x0059,0x0304,0x0232},{0x0059,0x0307,0x1E8E},{0x0059,0x0308,0x0178},{0x0059,0x0309,0x1EF6},{0x0059,0x0323,0x1EF4},{0x005A,0x0301,0x0179},
+    {0x005A,0x0302,0x1E90},{0x005A,0x0307,0x017B},{0x005A,0x030C,0x017D},{0x005A,0x0323,0x1E92},{0x005A,0x0331,0x1E94},{0x0061,0x0300,0x00E0},
+    {0x0061,0x0301,0x00E1},{0x0061,0x0302,0x00E2},{0x0061,0x0303,0x00E3},{0x0061,0x0304,0x0101},{0x0061,0x0306,0x0103},{0x0061,0x0307,0x0227},
+    {0x0061,0x0308,0x00E4},{0x0061,0x0309,0x1EA3},{0x0061,0x030A,0x00E5},{0x0061,0x030C,0x01CE},{0x0061,0x030F,0x0201},{0x0061,0x0311,0x0203},
+    {0x0061,0x0323,0x1EA1},{0x0061,0x0325,0x1E01},{0x0061,0x0328,0x0105},{0x0062,0x0307,0x1E03},{0x0062,0x0323,0x1E05},{0x0062,0x0331,0x1E07},
+    {0x0063,0x0301,0x0107},{0x0063,0x0302,0x0109},{0x0063,0x0307,0x010B},{0x0063,0x030C,0x010D},{0x0063,0x0327,0x00E7},{0x0064,0x0307,0x1E0B},
+    {0x0064,0x030C,0x010F},{0x0064,0x0323,0x1E0D},{0x0064,0x0327,0x1E11},{0x0064,0x032D,0x1E13},{0x0064,0x0331,0x1E0F},{0x0065,0x0300,0x00E8},
+    {0x0065,0x0301,0x00E9},{0x0065,0x0302,0x00EA},{0x0065,0x0303,0x1EBD},{0x0065,0x0304,0x0113},{0x0065,0x0306,0x0115},{0x0065,0x0307,0x0117},
+    {0x0065,0x0308,0x00EB},{0x0065,0x0309,0x1EBB},{0x0065,0x030C,0x011B},{0x0065,0x030F,0x0205},{0x0065,0x0311,0x0207},{0x0065,0x0323,0x1EB9},
+    {0x0065,0x0327,0x0229},{0x0065,0x0328,0x0119},{0x0065,0x032D,0x1E19},{0x0065,0x0330,0x1E1B},{0x0066,0x0307,0x1E1F},{0x0067,0x0301,0x01F5},
+    {0x0067,0x0302,0x011D},{0x0067,0x0304,0x1E21},{0x0067,0x0306,0x011F},{0x0067,0x0307,0x0121},{0x0067,0x030C,0x01E7},{0x0067,0x0327,0x0123},
+    {0x0068,0x0302,0x0125},{0x0068,0x0307,0x1E23},{0x0068,0x0308,0x1E27},{0x0068,0x030C,0x021F},{0x0068,0x0323,0x1E25},{0x0068,0x0327,0x1E29},
+    {0x0068,0x032E,0x1E2B},{0x0068,0x0331,0x1E96},{0x0069,0x0300,0x00EC},{0x0069,0x0301,0x00ED},{0x0069,0x0302,0x00EE},{0x0069,0x0303,0x0129},
+    {0x0069,0x0304,0x012B},{0x0069,0x0306,0x012D},{0x0069,0x0308,0x00EF},{0x0069,0x0309,0x1EC9},{0x0069,0x030C,0x01D0},{0x0069,0x030F,0x0209},
+    {0x0069,0x0311,0x020B},{0x0069,0x0323,0x1ECB},{0x0069,0x0328,0x012F},{0x0069,0x0330,0x1E2D},{0x006A,0x0302,0x0135},{0x006A,0x030C,0x01F0},
+    {0x006B,0x0301,0x1E31},{0x006B,0x030C,0x01E9},{0x006B,0x0323,0x1E33},{0x006B,0x0327,0x0137},{0x006B,0x0331,0x1E35},{0x006C,0x0301,0x013A},
+    {0x006C,0x030C,0x013E},{0x006C,0x0323,0x1E37},{0x006C,0x0327,0x013C},{0x006C,0x032D,0x1E3D},{0x006C,0x0331,0x1E3B},{0x006D,0x0301,0x1E3F},
+    {0x006D,0x0307,0x1E41},{0x006D,0x0323,0x1E43},{0x006E,0x0300,0x01F9},{0x006E,0x0301,0x0144},{0x006E,0x0303,0x00F1},{0x006E,0x0307,0x1E45},
+    {0x006E,0x030C,0x0148},{0x006E,0x0323,0x1E47},{0x006E,0x0327,0x0146},{0x006E,0x032D,0x1E4B},{0x006E,0x0331,0x1E49},{0x006F,0x0300,0x00F2},
+    {0x006F,0x0301,0x00F3},{0x006F,0x0302,0x00F4},{0x006F,0x0303,0x00F5},{0x006F,0x0304,0x014D},{0x006F,0x0306,0x014F},{0x006F,0x0307,0x022F},
+    {0x006F,0x0308,0x00F6},{0x006F,0x0309,0x1ECF},{0x006F,0x030B,0x0151},{0x006F,0x030C,0x01D2},{0x006F,0x030F,0x020D},{0x006F,0x0311,0x020F},
+    {0x006F,0x031B,0x01A1},{0x006F,0x0323,0x1ECD},{0x006F,0x0328,0x01EB},{0x0070,0x0301,0x1E55},{0x0070,0x0307,0x1E57},{0x0072,0x0301,0x0155},
+    {0x0072,0x0307,0x1E59},{0x0072,0x030C,0x0159},{0x0072,0x030F,0x0211},{0x0072,0x0311,0x0213},{0x0072,0x0323,0x1E5B},{0x0072,0x0327,0x0157},
+    {0x0072,0x0331,0x1E5F},{0x0073,0x0301,0x015B},{0x0073,0x0302,0x015D},{0x0073,0x0307,0x1E61},{0x0073,0x030C,0x0161},{0x0073,0x0323,0x1E63},
+    {0x0073,0x0326,0x0219},{0x0073,0x0327,0x015F},{0x0074,0x0307,0x1E6B},{0x0074,0x0308,0x1E97},{0x0074,0x030C,0x0165},{0x0074,0x0323,0x1E6D},
+    {0x0074,0x0326,0x021B},{0x0074,0x0327,0x0163},{0x0074,0x032D,0x1E71},{0x0074,0x0331,0x1E6F},{0x0075,0x0300,0x00F9},{0x0075,0x0301,0x00FA},
+    {0x0075,0x0302,0x00FB},{0x0075,0x0303,0x0169},{0x0075,0x0304,0x016B},{0x0075,0x0306,0x016D},{0x0075,0x0308,0x00FC},{0x0075,0x0309,0x1EE7},
+    {0x0075,0x030A,0x016F},{0x0075,0x030B,0x0171},{0x0075,0x030C,0x01D4},{0x0075,0x030F,0x0215},{0x0075,0x0311,0x0217},{0x0075,0x031B,0x01B0},
+    {0x0075,0x0323,0x1EE5},{0x0075,0x0324,0x1E73},{0x0075,0x0328,0x0173},{0x0075,0x032D,0x1E77},{0x0075,0x0330,0x1E75},{0x0076,0x0303,0x1E7D},
+    {0x0076,0x0323,0x1E7F},{0x0077,0x0300,0x1E81},{0x0077,0x0301,0x1E83},{0x0077,0x0302,0x0175},{0x0077,0x0307,0x1E87},{0x0077,0x0308,0x1E85},
+    {0x0077,0x030A,0x1E98},{0x0077,0x0323,0x1E89},{0x0078,0x0307,0x1E8B},{0x0078,0x0308,0x1E8D},{0x0079,0x0300,0x1EF3},{0x0079,0x0301,0x00FD},
+    {0x0079,0x0302,0x0177},{0x0079,0x0303,0x1EF9},{0x0079,0x0304,0x0233},{0x0079,0x0307,0x1E8F},{0x0079,0x0308,0x00FF},{0x0079,0x0309,0x1EF7},
+    {0x0079,0x030A,0x1E99},{0x0079,0x0323,0x1EF5},{0x007A,0x0301,0x017A},{0x007A,0x0302,0x1E91},{0x007A,0x0307,0x017C},{0x007A,0x030C,0x017E},
+    {0x007A,0x0323,0x1E93},{0x007A,0x0331,0x1E95},{0x00A8,0x0301,0x0385},{0x00C2,0x0300,0x1EA6},{0x00C2,0x0301,0x1EA4},{0x00C2,0x0303,0x1EAA},
+    {0x00C2,0x0309,0x1EA8},{0x00C4,0x0304,0x01DE},{0x00C5,0x0301,0x01FA},{0x00C6,0x0301,0x01FC},{0x00C6,0x0304,0x01E2},{0x00C7,0x0301,0x1E08},
+    {0x00CA,0x0300,0x1EC0},{0x00CA,0x0301,0x1EBE},{0x00CA,0x0303,0x1EC4},{0x00CA,0x0309,0x1EC2},{0x00CF,0x0301,0x1E2E},{0x00D4,0x0300,0x1ED2},
+    {0x00D4,0x0301,0x1ED0},{0x00D4,0x0303,0x1ED6},{0x00D4,0x0309,0x1ED4},{0x00D5,0x0301,0x1E4C},{0x00D5,0x0304,0x022C},{0x00D5,0x0308,0x1E4E},
+    {0x00D6,0x0304,0x022A},{0x00D8,0x0301,0x01FE},{0x00DC,0x0300,0x01DB},{0x00DC,0x0301,0x01D7},{0x00DC,0x0304,0x01D5},{0x00DC,0x030C,0x01D9},
+    {0x00E2,0x0300,0x1EA7},{0x00E2,0x0301,0x1EA5},{0x00E2,0x0303,0x1EAB},{0x00E2,0x0309,0x1EA9},{0x00E4,0x0304,0x01DF},{0x00E5,0x0301,0x01FB},
+    {0x00E6,0x0301,0x01FD},{0x00E6,0x0304,0x01E3},{0x00E7,0x0301,0x1E09},{0x00EA,0x0300,0x1EC1},{0x00EA,0x0301,0x1EBF},{0x00EA,0x0303,0x1EC5},
+    {0x00EA,0x0309,0x1EC3},{0x00EF,0x0301,0x1E2F},{0x00F4,0x0300,0x1ED3},{0x00F4,0x0301,0x1ED1},{0x00F4,0x0303,0x1ED7},{0x00F4,0x0309,0x1ED5},
+    {0x00F5,0x0301,0x1E4D},{0x00F5,0x0304,0x022D},{0x00F5,0x0308,0x1E4F},{0x00F6,0x0304,0x022B},{0x00F8,0x0301,0x01FF},{0x00FC,0x0300,0x01DC},
+    {0x00FC,0x0301,0x01D8},{0x00FC,0x0304,0x01D6},{0x00FC,0x030C,0x01DA},{0x0102,0x0300,0x1EB0},{0x0102,0x0301,0x1EAE},{0x0102,0x0303,0x1EB4},
+    {0x0102,0x0309,0x1EB2},{0x0103,0x0300,0x1EB1},{0x0103,0x0301,0x1EAF},{0x0103,0x0303,0x1EB5},{0x0103,0x0309,0x1EB3},{0x0112,0x0300,0x1E14},
+    {0x0112,0x0301,0x1E16},{0x0113,0x0300,0x1E15},{0x0113,0x0301,0x1E17},{0x014C,0x0300,0x1E50},{0x014C,0x0301,0x1E52},{0x014D,0x0300,0x1E51},
+    {0x014D,0x0301,0x1E53},{0x015A,0x0307,0x1E64},{0x015B,0x0307,0x1E65},{0x0160,0x0307,0x1E66},{0x0161,0x0307,0x1E67},{0x0168,0x0301,0x1E78},
+    {0x0169,0x0301,0x1E79},{0x016A,0x0308,0x1E7A},{0x016B,0x0308,0x1E7B},{0x017F,0x0307,0x1E9B},{0x01A0,0x0300,0x1EDC},{0x01A0,0x0301,0x1EDA},
+    {0x01A0,0x0303,0x1EE0},{0x01A0,0x0309,0x1EDE},{0x01A0,0x0323,0x1EE2},{0x01A1,0x0300,0x1EDD},{0x01A1,0x0301,0x1EDB},{0x01A1,0x0303,0x1EE1},
+    {0x01A1,0x0309,0x1EDF},{0x01A1,0x0323,0x1EE3},{0x01AF,0x0300,0x1EEA},{0x01AF,0x0301,0x1EE8},{0x01AF,0x0303,0x1EEE},{0x01AF,0x0309,0x1EEC},
+    {0x01AF,0x0323,0x1EF0},{0x01B0,0x0300,0x1EEB},{0x01B0,0x0301,0x1EE9},{0x01B0,0x0303,0x1EEF},{0x01B0,0x0309,0x1EED},{0x01B0,0x0323,0x1EF1},
+    {0x01B7,0x030C,0x01EE},{0x01EA,0x0304,0x01EC},{0x01EB,0x0304,0x01ED},{0x0226,0x0304,0x01E0},{0x0227,0x0304,0x01E1},{0x0228,0x0306,0x1E1C},
+    {0x0229,0x0306,0x1E1D},{0x022E,0x0304,0x0230},{0x022F,0x0304,0x0231},{0x0292,0x030C,0x01EF},{0x0391,0x0301,0x0386},{0x0395,0x0301,0x0388},
+    {0x0397,0x0301,0x0389},{0x0399,0x0301,0x038A},{0x0399,0x0308,0x03AA},{0x039F,0x0301,0x038C},{0x03A5,0x0301,0x038E},{0x03A5,0x0308,0x03AB},
+    {0x03A9,0x0301,0x038F},{0x03B1,0x0301,0x03AC},{0x03B5,0x0301,0x03AD},{0x03B7,0x0301,0x03AE},{0x03B9,0x0301,0x03AF},{0x03B9,0x0308,0x03CA},
+    {0x03BF,0x0301,0x03CC},{0x03C5,0x0301,0x03CD},{0x03C5,0x0308,0x03CB},{0x03C9,0x0301,0x03CE},{0x03CA,0x0301,0x0390},{0x03CB,0x0301,0x03B0},
+    {0x03D2,0x0301,0x03D3},{0x03D2,0x0308,0x03D4},{0x0406,0x0308,0x0407},{0x0410,0x0306,0x04D0},{0x0410,0x0308,0x04D2},{0x0413,0x0301,0x0403},
+    {0x0415,0x0300,0x0400},{0x0415,0x0306,0x04D6},{0x0415,0x0308,0x0401},{0x0416,0x0306,0x04C1},{0x0416,0x0308,0x04DC},{0x0417,0x0308,0x04DE},
+    {0x0418,0x0300,0x040D},{0x0418,0x0304,0x04E2},{0x0418,0x0306,0x0419},{0x0418,0x0308,0x04E4},{0x041A,0x0301,0x040C},{0x041E,0x0308,0x04E6},
+    {0x0423,0x0304,0x04EE},{0x0423,0x0306,0x040E},{0x0423,0x0308,0x04F0},{0x0423,0x030B,0x04F2},{0x0427,0x0308,0x04F4},{0x042B,0x0308,0x04F8},
+    {0x042D,0x0308,0x04EC},{0x0430,0x0306,0x04D1},{0x0430,0x0308,0x04D3},{0x0433,0x0301,0x0453},{0x0435,0x0300,0x0450},{0x0435,0x0306,0x04D7},
+    {0x0435,0x0308,0x0451},{0x0436,0x0306,0x04C2},{0x0436,0x0308,0x04DD},{0x0437,0x0308,0x04DF},{0x0438,0x0300,0x045D},{0x0438,0x0304,0x04E3},
+    {0x0438,0x0306,0x0439},{0x0438,0x0308,0x04E5},{0x043A,0x0301,0x045C},{0x043E,0x0308,0x04E7},{0x0443,0x0304,0x04EF},{0x0443,0x0306,0x045E},
+    {0x0443,0x0308,0x04F1},{0x0443,0x030B,0x04F3},{0x0447,0x0308,0x04F5},{0x044B,0x0308,0x04F9},{0x044D,0x0308,0x04ED},{0x0456,0x0308,0x0457},
+    {0x0474,0x030F,0x0476},{0x0475,0x030F,0x0477},{0x04D8,0x0308,0x04DA},{0x04D9,0x0308,0x04DB},{0x04E8,0x0308,0x04EA},{0x04E9,0x0308,0x04EB},
+    {0x1E36,0x0304,0x1E38},{0x1E37,0x0304,0x1E39},{0x1E5A,0x0304,0x1E5C},{0x1E5B,0x0304,0x1E5D},{0x1E62,0x0307,0x1E68},{0x1E63,0x0307,0x1E69},
+    {0x1EA0,0x0302,0x1EAC},{0x1EA0,0x0306,0x1EB6},{0x1EA1,0x0302,0x1EAD},{0x1EA1,0x0306,0x1EB7},{0x1EB8,0x0302,0x1EC6},{0x1EB9,0x0302,0x1EC7},
+    {0x1ECC,0x0302,0x1ED8},{0x1ECD,0x0302,0x1ED9},
+};
+
+// 谚文音节的组合, 见Unicode标准3.12节
+constexpr char32_t HANGUL_S = 0xAC00, HANGUL_L = 0x1100, HANGUL_V = 0x1161, HANGUL_T = 0x11A7;
+constexpr char32_t HANGUL_LCOUNT = 19, HANGUL_VCOUNT = 21, HANGUL_TCOUNT = 28;
+constexpr char32_t HANGUL_SCOUNT = HANGUL_LCOUNT * HANGUL_VCOUNT * HANGUL_TCOUNT;
+
+// 组合两个字符, 不能组合时返回0
+static char32_t compose(char32_t a, char32_t b)
+{
+    if(a - HANGUL_L < HANGUL_LCOUNT && b - HANGUL_V < HANGUL_VCOUNT)
+        return HANGUL_S + ((a - HANGUL_L) * HANGUL_VCOUNT + b - HANGUL_V) * HANGUL_TCOUNT;
+    if(a - HANGUL_S < HANGUL_SCOUNT && (a - HANGUL_S) % HANGUL_TCOUNT == 0 && b - HANGUL_T - 1 < HANGUL_TCOUNT - 1)
+        return a + b - HANGUL_T;
+    if(b < 0x0300 || b > 0x0345 || a > 0xFFFF)
+        return 0;
+
+    auto iter = std::lower_bound(std::begin(g_compose),std::end(g_compose),std::make_pair(a,b),
+        [](const compose_item& it,const std::pair<char32_t,char32_t>& key){
+        return it.base < key.first || (it.base == key.first && it.mark < key.second);
+    });
+    if(iter == std::end(g_compose) || iter->base != a || iter->mark != b)
+        return 0;
+    return iter->result;
+}
+
+static char32_t fold_case(char32_t c)
+{
+    if(c < 0x41 || c > 0xFFFF)
+        return c;
+    auto iter = std::upper_bound(std::begin(g_fold),std::end(g_fold),c,
+        [](char32_t c,const fold_range& it){ return c < it.first; });
+    if(iter == std::begin(g_fold))
+        return c;
+    --iter;
+    if(c > iter->last || (c - iter->first) % iter->stride != 0)
+        return c;
+    return c + iter->delta;
+}
+
+void CKT_CALL Text::u8fold(std::string& out, u8str in, int len)
+{
+    out.clear();
+    if(!in) return;
+    std::u32string buf;
+    u8to32(buf, in, len);
+
+    size_t n = 0;
+    for(auto c : buf)
+    {
+        const char32_t ret = n > 0 ? compose(buf[n - 1],c) : 0;
+        if(ret)
+            buf[n - 1] = ret;
+        else
+            buf[n++] = c;
+    }
+    if(n == 0) return;
+    for(size_t i = 0; i < n; ++i)
+        buf[i] = fold_case(buf[i]);
+    u32to8(out, buf.data(), (int)n);
+}
+
+}
@@ -0,0 +1,666 @@
+/*
+*******************************************************************************
+    ChenKe404's text library
+*******************************************************************************
+@project	cktext
+@authors	chenke404
+@file	image.cpp
+@brief 	read-only flat catalog image
+
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 chenke404
+******************************************************************************
+*/
+
+
+#include "image.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cctype>
+#include <atomic>
+#include <mutex>
+
+#include <thread>
+#include <fstream>
+
+#ifdef __linux__
+#include <filesystem>
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace ck
+{
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+/// 映像布局
+/// header | group_rec[sz_group] | item_rec[...] | 字符串池
+/// 所有偏移都相对于映像起始地址, 记录按8字节对齐, 字符串以\0结尾
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+constexpr uint32_t IMAGE_VERSION = 1;
+
+struct header
+{
+    char tag[4];        // "CKI\0"
+    uint32_t version;
+    uint64_t size;      // 映像总大小
+    uint32_t sz_group;
+    uint32_t reserved;
+    uint64_t groups;    // 组表的偏移, 组按查询顺序排列
+};
+
+struct group_rec
+{
+    uint64_t name;      // 组名的偏移
+    uint64_t items;     // 翻译项表的偏移, 翻译项按原文字节序排列
+    uint64_t sz_item;
+    uint32_t sz_name;
+    uint32_t priority;
+};
+
+struct item_rec
+{
+    uint64_t src;       // 原文的偏移
+    uint64_t trs;       // 译文的偏移
+    uint32_t sz_src;
+    uint32_t sz_trs;
+};
+
+static_assert(sizeof(header) == 32, "unexpected image header size");
+static_assert(sizeof(group_rec) == 32, "unexpected image group size");
+static_assert(sizeof(item_rec) == 24, "unexpected image item size");
+
+inline int compare(const char* a, size_t sz_a, const char* b, size_t sz_b)
+{
+    const auto ret = memcmp(a, b, sz_a < sz_b ? sz_a : sz_b);
+    if(ret != 0) return ret;
+    return sz_a < sz_b ? -1 : (sz_a > sz_b ? 1 : 0);
+}
+
+}
+
+Image::~Image()
+{
+    close();
+}
+
+bool Image::build(const Text& text, std::vector<uint8_t>& out)
+{
+    const auto& groups = text._sorted;
+    size_t sz_item = 0;
+    size_t sz_pool = 0;
+    for(auto grp : groups)
+    {
+        sz_item += grp->_map.size();
+        for(auto& it : grp->_map)
+        {
+            if(it.first.size() > UINT32_MAX || it.second.size() > UINT32_MAX)
+            {
+                std::cerr << "Image::build: string is too long!" << std::endl;
+                return false;
+            }
+            sz_pool += it.first.size() + it.second.size() + 2;
+        }
+    }
+    for(auto& it : text._map)
+        sz_pool += it.first.size() + 1;
+
+    const size_t ofs_groups = sizeof(header);
+    const size_t ofs_items = ofs_groups + groups.size() * sizeof(group_rec);
+    const size_t ofs_pool = ofs_items + sz_item * sizeof(item_rec);
+    out.assign(ofs_pool + sz_pool, 0);
+
+    auto data = out.data();
+    size_t pool = ofs_pool;
+    auto put = [&](const std::string& str) -> uint64_t {
+        const auto ofs = pool;
+        memcpy(data + pool, str.c_str(), str.size() + 1);
+        pool += str.size() + 1;
+        return ofs;
+    };
+
+    auto hdr = (header*)data;
+    memcpy(hdr->tag, "CKI", 4);
+    hdr->version = IMAGE_VERSION;
+    hdr->size = out.size();
+    hdr->sz_group = (uint32_t)groups.size();
+    hdr->groups = ofs_groups;
+
+    // 组名需要从Text的容器中取得, 先建立 组 -> 组名 的表
+    std::unordered_map<const Text::Group*,const std::string*> names;
+    names.reserve(text._map.size());
+    for(auto& it : text._map)
+        names[&it.second] = &it.first;
+
+    auto grec = (group_rec*)(data + ofs_groups);
+    auto irec = (item_rec*)(data + ofs_items);
+    for(auto grp : groups)
+    {
+        const auto& name = *names[grp];
+        grec->name = put(name);
+        grec->sz_name = (uint32_t)name.size();
+        grec->priority = grp->_priority;
+        grec->items = (uint8_t*)irec - data;
+        grec->sz_item = grp->_map.size();
+        for(auto& it : grp->_map)
+        {
+            irec->src = put(it.first);
+            irec->sz_src = (uint32_t)it.first.size();
+            irec->trs = put(it.second);
+            irec->sz_trs = (uint32_t)it.second.size();
+            ++irec;
+        }
+        ++grec;
+    }
+    return true;
+}
+
+#ifndef _WIN32
+static void advise(void* ptr, size_t size, int opts)
+{
+#ifdef MADV_HUGEPAGE
+    if(opts & Image::OPT_HUGEPAGE)
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+}
+
+// 读入数据并为每一页建立页表, 避免首次查询时缺页
+static void prefault(const void* ptr, size_t size)
+{
+    madvise(const_cast<void*>(ptr), size, MADV_WILLNEED);
+    const auto page = (size_t)sysconf(_SC_PAGESIZE);
+    auto data = (const volatile uint8_t*)ptr;
+    uint8_t sum = 0;
+    for(size_t i = 0; i < size; i += page)
+        sum += data[i];
+    (void)sum;
+}
+#endif
+
+bool Image::load(const Text& text, int opts)
+{
+    close();
+    if(!build(text, _buf))
+        return false;
+    _opts = opts;
+    _data = _buf.data();
+    _size = _buf.size();
+    if(opts != OPT_NONE)
+    {
+        size_t mapped = 0;
+        if(auto ptr = alloc(_buf.data(), _buf.size(), mapped))
+        {
+            _map = ptr;
+            _sz_map = mapped;
+            _data = (const uint8_t*)ptr;
+            _buf.clear();
+            _buf.shrink_to_fit();
+        }
+    }
+    return true;
+}
+
+void* Image::alloc(const uint8_t* data, size_t size, size_t& mapped) const
+{
+#ifdef _WIN32
+    return nullptr;
+#else
+    void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if(_opts & OPT_HUGETLB)
+    {
+        constexpr size_t SZ_HUGE = 2 << 20;
+        mapped = (size + SZ_HUGE - 1) / SZ_HUGE * SZ_HUGE;
+        ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if(ptr == MAP_FAILED)   // 没有可用的显式大页时退回普通页
+    {
+        mapped = size;
+        ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr == MAP_FAILED)
+            return nullptr;
+        // 须在写入前设置, 缺页时才会分配大页
+        advise(ptr, mapped, _opts);
+    }
+    // 匿名内存在复制时已全部写入, 无需另外预取
+    memcpy(ptr, data, size);
+    mprotect(ptr, mapped, PROT_READ);
+    return ptr;
+#endif
+}
+
+bool Image::map(int fd, size_t size, const char* name)
+{
+#ifdef _WIN32
+    return false;
+#else
+    int flags = MAP_SHARED;
+    const bool populate = (_opts & OPT_PREFAULT) && !(_opts & OPT_HUGEPAGE);
+#ifdef MAP_POPULATE
+    if(populate)
+        flags |= MAP_POPULATE;
+#endif
+    auto ptr = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+    if(ptr == MAP_FAILED)
+        return false;
+    advise(ptr, size, _opts);
+    // 使用大页时须在设置之后再预取
+    if((_opts & OPT_PREFAULT) && !populate)
+        prefault(ptr, size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(!check((const uint8_t*)ptr, size))
+    {
+        std::cerr << "Image::open: illegal image data:" << name << std::endl;
+        munmap(ptr, size);
+        return false;
+    }
+    _map = ptr;
+    _sz_map = size;
+    _data = (const uint8_t*)ptr;
+    _size = size;
+    return true;
+#endif
+}
+
+bool Image::save(const char* filename) const
+{
+    if(!_data) return false;
+    std::ofstream fo(filename, std::ios::binary);
+    if(!fo.is_open()) return false;
+    fo.write((const char*)_data, _size);
+    fo.close();
+    return !fo.fail();
+}
+
+bool Image::open(const char* filename, int opts)
+{
+    close();
+    if(!filename) return false;
+#ifdef _WIN32
+    std::ifstream fi(filename, std::ios::binary);
+    if(!fi) return false;
+    _buf.assign(std::istreambuf_iterator<char>(fi), std::istreambuf_iterator<char>());
+    if(!check(_buf.data(), _buf.size()))
+    {
+        std::cerr << "Image::open: illegal image data:" << filename << std::endl;
+        _buf.clear();
+        return false;
+    }
+    _data = _buf.data();
+    _size = _buf.size();
+    return true;
+#else
+    const int fd = ::open(filename, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header))
+    {
+        ::close(fd);
+        return false;
+    }
+    _opts = opts;
+    const bool ret = map(fd, (size_t)st.st_size, filename);
+    ::close(fd);
+    if(!ret) _opts = OPT_NONE;
+    return ret;
+#endif
+}
+
+bool Image::attach(const uint8_t* data, size_t size)
+{
+    close();
+    if(!check(data, size))
+        return false;
+    _data = data;
+    _size = size;
+    return true;
+}
+
+bool Image::publish(const char* name, const Text& text, unsigned mode)
+{
+#ifdef _WIN32
+    std::cerr << "Image::publish: shared memory is not supported on this platform!" << std::endl;
+    return false;
+#else
+    if(!name) return false;
+    std::vector<uint8_t> buf;
+    if(!build(text, buf))
+        return false;
+
+    // 先删除旧的共享内存再重新创建, 已附加旧数据的进程不受影响
+    shm_unlink(name);
+    const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0)
+    {
+        std::cerr << "Image::publish: can't create shared memory:" << name << std::endl;
+        return false;
+    }
+    // shm_open的权限受umask影响, 创建后再设置为调用者指定的权限
+    if(fchmod(fd, (mode_t)mode) != 0)
+    {
+        std::cerr << "Image::publish: can't change the mode of shared memory:" << name << std::endl;
+        ::close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    if(ftruncate(fd, (off_t)buf.size()) != 0)
+    {
+        std::cerr << "Image::publish: can't resize shared memory:" << name << std::endl;
+        ::close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    auto ptr = mmap(nullptr, buf.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(ptr == MAP_FAILED)
+    {
+        std::cerr << "Image::publish: can't map shared memory:" << name << std::endl;
+        shm_unlink(name);
+        return false;
+    }
+    // 最后写入文件标签, 附加方看到标签时其余数据已经完整
+    auto dst = (uint8_t*)ptr;
+    memcpy(dst + 4, buf.data() + 4, buf.size() - 4);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(dst, buf.data(), 4);
+    munmap(ptr, buf.size());
+    return true;
+#endif
+}
+
+bool Image::unpublish(const char* name)
+{
+#ifdef _WIN32
+    return false;
+#else
+    return name && shm_unlink(name) == 0;
+#endif
+}
+
+bool Image::open_shared(const char* name, int opts)
+{
+    close();
+#ifdef _WIN32
+    std::cerr << "Image::open_shared: shared memory is not supported on this platform!" << std::endl;
+    return false;
+#else
+    if(!name) return false;
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header))
+    {
+        ::close(fd);
+        return false;
+    }
+    _opts = opts;
+    const bool ret = map(fd, (size_t)st.st_size, name);
+    ::close(fd);
+    if(!ret) _opts = OPT_NONE;
+    return ret;
+#endif
+}
+
+#ifdef __linux__
+// 解析形如"0-3,8-11"的CPU列表
+static std::vector<int> parse_cpus(const std::string& str)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while(pos < str.size())
+    {
+        auto end = str.find(',', pos);
+        if(end == std::string::npos) end = str.size();
+        const auto item = str.substr(pos, end - pos);
+        const auto dash = item.find('-');
+        const int first = atoi(item.c_str());
+        const int last = dash == std::string::npos ? first : atoi(item.c_str() + dash + 1);
+        for(int i = first; i <= last && i >= 0; ++i)
+            cpus.push_back(i);
+        pos = end + 1;
+    }
+    return cpus;
+}
+#endif
+
+bool Image::replicate()
+{
+#ifdef __linux__
+    if(!_data || !_replicas.empty())
+        return false;
+
+    // 读取每个节点的CPU列表
+    namespace fs = std::filesystem;
+    std::vector<std::vector<int>> nodes;
+    std::error_code ec;
+    for(auto& it : fs::directory_iterator("/sys/devices/system/node", ec))
+    {
+        const auto name = it.path().filename().string();
+        if(name.compare(0, 4, "node") != 0 || name.size() < 5 || !isdigit((uint8_t)name[4]))
+            continue;
+        const auto id = (size_t)atoi(name.c_str() + 4);
+        std::ifstream fi(it.path() / "cpulist");
+        std::string line;
+        if(!std::getline(fi, line))
+            continue;
+        if(nodes.size() <= id)
+            nodes.resize(id + 1);
+        nodes[id] = parse_cpus(line);
+    }
+    if(nodes.size() < 2)
+        return false;
+
+    std::vector<int> cpu_node;
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        for(auto cpu : nodes[i])
+        {
+            if(cpu_node.size() <= (size_t)cpu)
+                cpu_node.resize(cpu + 1, -1);
+            cpu_node[cpu] = (int)i;
+        }
+    }
+
+    // 在绑定到各节点的线程中分配并首次写入副本
+    std::vector<void*> replicas(nodes.size(), nullptr);
+    std::vector<size_t> sizes(nodes.size(), 0);
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        if(nodes[i].empty())
+            continue;
+        threads.emplace_back([this, &nodes, &replicas, &sizes, i] {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for(auto cpu : nodes[i])
+            {
+                if(cpu < CPU_SETSIZE)
+                    CPU_SET(cpu, &set);
+            }
+            if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+                return;
+            replicas[i] = alloc(_data, _size, sizes[i]);
+        });
+    }
+    for(auto& it : threads)
+        it.join();
+
+    // 复制失败的节点使用原映像
+    bool ok = false;
+    for(auto& it : replicas)
+        ok |= it != nullptr;
+    if(!ok)
+        return false;
+    _replicas = std::move(replicas);
+    _sz_replicas = std::move(sizes);
+    _cpu_node = std::move(cpu_node);
+    return true;
+#else
+    return false;
+#endif
+}
+
+const uint8_t* Image::local() const
+{
+#ifdef __linux__
+    if(!_replicas.empty())
+    {
+        const int cpu = sched_getcpu();
+        if(cpu >= 0 && (size_t)cpu < _cpu_node.size())
+        {
+            const int node = _cpu_node[cpu];
+            if(node >= 0 && _replicas[node])
+                return (const uint8_t*)_replicas[node];
+        }
+    }
+#endif
+    return _data;
+}
+
+void Image::close()
+{
+#ifndef _WIN32
+    for(size_t i = 0; i < _replicas.size(); ++i)
+    {
+        if(_replicas[i]) munmap(_replicas[i], _sz_replicas[i]);
+    }
+    if(_map)
+        munmap(_map, _sz_map);
+#endif
+    _replicas.clear();
+    _sz_replicas.clear();
+    _cpu_node.clear();
+    _opts = OPT_NONE;
+    _map = nullptr;
+    _sz_map = 0;
+    _buf.clear();
+    _buf.shrink_to_fit();
+    _data = nullptr;
+    _size = 0;
+}
+
+bool Image::valid() const
+{
+    return _data != nullptr;
+}
+
+const uint8_t* Image::data() const
+{
+    return _data;
+}
+
+size_t Image::size() const
+{
+    return _size;
+}
+
+bool Image::check(const uint8_t* data, size_t size) const
+{
+    if(!data || size < sizeof(header) || ((uintptr_t)data & 7) != 0)
+        return false;
+    auto hdr = (const header*)data;
+    if(memcmp(hdr->tag, "CKI", 4) != 0 || hdr->version != IMAGE_VERSION || hdr->size != size)
+        return false;
+
+    // 偏移必须对齐且不越界
+    auto table = [size](uint64_t ofs, uint64_t count, size_t sz_rec) {
+        return (ofs & 7) == 0 && ofs <= size && count <= (size - ofs) / sz_rec;
+    };
+    auto str = [data, size](uint64_t ofs, uint32_t len) {
+        return ofs < size && len < size - ofs && data[ofs + len] == 0;
+    };
+
+    if(!table(hdr->groups, hdr->sz_group, sizeof(group_rec)))
+        return false;
+    auto grec = (const group_rec*)(data + hdr->groups);
+    for(uint32_t i = 0; i < hdr->sz_group; ++i, ++grec)
+    {
+        if(!str(grec->name, grec->sz_name) || !table(grec->items, grec->sz_item, sizeof(item_rec)))
+            return false;
+        auto irec = (const item_rec*)(data + grec->items);
+        for(uint64_t j = 0; j < grec->sz_item; ++j, ++irec)
+        {
+            if(!str(irec->src, irec->sz_src) || !str(irec->trs, irec->sz_trs))
+                return false;
+        }
+    }
+    return true;
+}
+
+const void* Image::find(const uint8_t* data, u8str src) const
+{
+    if(!src || !data) return nullptr;
+    const auto len = strlen(src);
+    auto hdr = (const header*)data;
+    auto grec = (const group_rec*)(data + hdr->groups);
+    for(uint32_t i = 0; i < hdr->sz_group; ++i, ++grec)
+    {
+        auto items = (const item_rec*)(data + grec->items);
+        uint64_t lo = 0, hi = grec->sz_item;
+        while(lo < hi)
+        {
+            const auto mid = lo + (hi - lo) / 2;
+            auto& it = items[mid];
+            const auto ret = compare((const char*)data + it.src, it.sz_src, src, len);
+            if(ret < 0)
+                lo = mid + 1;
+            else if(ret > 0)
+                hi = mid;
+            else
+                return &it;
+        }
+    }
+    return nullptr;
+}
+
+Image::u8str Image::u8(u8str src, u8str def) const
+{
+    const auto data = local();
+    auto it = (const item_rec*)find(data, src);
+    if(!it || it->sz_trs == 0) // 原文不存在 或 译文不存在
+        return def;
+    return (const char*)data + it->trs;
+}
+
+size_t Image::offset(u8str src) const
+{
+    auto it = (const item_rec*)find(_data, src);
+    if(!it) return 0;
+    if(it->sz_trs == 0) return SIZE_MAX;
+    return (size_t)it->trs;
+}
+
+Image::u32str Image::u32(u8str src, u8str def) const
+{
+    const auto data = local();
+    auto it = (const item_rec*)find(data, src);
+    if(!it) return nullptr;
+    static std::u32string u32str;
+    static std::mutex mtx;
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if(it->sz_trs == 0) // 说明原文存在但译文不存在
+        Text::u8to32(u32str, def);
+    else
+        Text::u8to32(u32str, (const char*)data + it->trs);
+    return u32str.c_str();
+}
+
+}
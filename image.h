@@ -0,0 +1,121 @@
+/*
+*******************************************************************************
+    ChenKe404's text library
+*******************************************************************************
+@project	cktext
+@authors	chenke404
+@file	image.h
+@brief 	read-only flat catalog image
+
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 chenke404
+******************************************************************************
+*/
+
+
+#ifndef CK_IMAGE_H
+#define CK_IMAGE_H
+
+/*
+ * 只读的扁平目录映像
+ * 映像内部只使用相对偏移, 与加载地址无关, 可以放在共享内存中被多个进程同时只读映射
+ * 查询规则与Text::u8相同: 按优先级依次查询各组, 返回第一个匹配的译文
+ */
+
+#include "text.h"
+
+namespace ck
+{
+
+struct Image
+{
+    using u8str = Text::u8str;
+    using u32str = Text::u32str;
+
+    // 内存选项, 只在POSIX平台上有效
+    enum Option
+    {
+        OPT_NONE = 0,
+        OPT_HUGEPAGE = 1,   // 建议内核使用透明大页(MADV_HUGEPAGE)
+        OPT_HUGETLB = 2,    // 使用预留的显式大页(MAP_HUGETLB), 失败时退回普通页, 只用于匿名内存
+        OPT_PREFAULT = 4,   // 映射时预先建立页表并读入数据(MAP_POPULATE, MADV_WILLNEED)
+    };
+
+    Image() = default;
+    Image(const Image&) = delete;
+    ~Image();
+
+    // 把Text序列化为映像
+    static bool build(const Text&, std::vector<uint8_t>& out);
+
+    // 从Text构建映像, 数据由本对象持有
+    // @opts Option的组合
+    bool load(const Text&, int opts = OPT_NONE);
+    // 使用外部内存中的映像, 不拷贝, 调用者需保证内存在close之前有效
+    bool attach(const uint8_t* data, size_t size);
+
+    // 保存映像文件
+    bool save(const char* filename) const;
+    // 以只读方式映射映像文件
+    // @opts Option的组合
+    bool open(const char* filename, int opts = OPT_NONE);
+
+    // 把Text发布到名为name的POSIX共享内存, 已存在则覆盖
+    // 发布后其他进程可以通过open_shared只读附加
+    // @mode 共享内存的访问权限, 默认只有当前用户可以附加
+    static bool publish(const char* name, const Text&, unsigned mode = 0600);
+    // 删除名为name的共享内存, 已附加的进程不受影响
+    static bool unpublish(const char* name);
+    // 以只读方式附加名为name的共享内存
+    // @opts Option的组合
+    bool open_shared(const char* name, int opts = OPT_NONE);
+
+    // 在每个NUMA节点上各复制一份映像, 由绑定到该节点的线程首次写入以保证内存在本地
+    // 之后的查询自动使用当前CPU所在节点的副本, 返回的译文也指向该副本
+    // 副本使用与load/open相同的内存选项
+    // 只在Linux上有效, 其他平台或只有一个节点时不复制并返回false
+    bool replicate();
+
+    void close();
+    bool valid() const;
+    const uint8_t* data() const;
+    size_t size() const;
+
+    // 获取第一个匹配的译文
+    // @def 译文不存在时的返回值
+    // @return utf8译文 或 nullptr(原文不存在) 或 def(译文不存在)
+    u8str u8(u8str src, u8str def = nullptr) const;
+
+    // 获取第一个匹配的译文在映像中的偏移
+    // @return 偏移 或 0(原文不存在) 或 SIZE_MAX(译文不存在)
+    size_t offset(u8str src) const;
+
+    // 获取第一个匹配的译文
+    // @def 译文不存在时的返回值
+    // @return utf32译文 或 nullptr(原文不存在) 或 def(译文不存在)
+    u32str u32(u8str src, u8str def = nullptr) const;
+private:
+    bool check(const uint8_t* data, size_t size) const;
+    // 在data指向的映像中查找第一个匹配的翻译项
+    const void* find(const uint8_t* data, u8str src) const;
+    // 当前线程应该使用的映像
+    const uint8_t* local() const;
+    // 按内存选项分配可写的匿名内存, 写入data后设为只读
+    void* alloc(const uint8_t* data, size_t size, size_t& mapped) const;
+    // 映射文件描述符指向的映像
+    bool map(int fd, size_t size, const char* name);
+private:
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+    int _opts = OPT_NONE;
+    std::vector<uint8_t> _buf;  // load时持有的数据
+    void* _map = nullptr;       // 映射的地址
+    size_t _sz_map = 0;
+    std::vector<void*> _replicas;   // 每个NUMA节点的副本
+    std::vector<size_t> _sz_replicas;   // 每个副本的映射大小
+    std::vector<int> _cpu_node;     // CPU编号 -> 节点编号
+};
+
+}
+
+#endif // !CK_IMAGE_H
@@ -0,0 +1,173 @@
+/*
+*******************************************************************************
+    ChenKe404's text library
+*******************************************************************************
+@project	cktext
+@authors	chenke404
+@file	similar.cpp
+@brief 	near-duplicate translation search
+
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 chenke404
+******************************************************************************
+*/
+
+
+#include "similar.h"
+
+#include <algorithm>
+
+namespace ck
+{
+
+// splitmix64的混合函数
+static inline uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+Similar::Similar(int ngram, int bands, int rows)
+    : _ngram(ngram < 1 ? 1 : ngram),
+    _bands(bands < 1 ? 1 : bands),
+    _rows(rows < 1 ? 1 : rows)
+{
+    // 种子固定, 同样的参数得到同样的签名
+    const int sz = _bands * _rows;
+    _seeds.resize(sz);
+    uint64_t s = 0x9e3779b97f4a7c15ull;
+    for(auto& it : _seeds)
+    {
+        s += 0x9e3779b97f4a7c15ull;
+        it = mix(s);
+    }
+}
+
+void Similar::build(const Text& text)
+{
+    clear();
+    const size_t sz_sig = _seeds.size();
+    size_t sz = 0;
+    for(auto& grp : text)
+        sz += std::distance(grp.second.begin(), grp.second.end());
+    _entries.reserve(sz);
+    _sigs.reserve(sz * sz_sig);
+
+    std::u32string str;
+    for(auto& grp : text)
+    {
+        for(auto& it : grp.second)
+        {
+            if(it.second.empty())
+                continue;
+            Text::u8to32(str, it.second.c_str(), (int)it.second.size());
+            if(str.empty())
+                continue;
+            const auto id = (uint32_t)_entries.size();
+            _entries.push_back({ &grp.second,&it });
+            _sigs.resize(_sigs.size() + sz_sig);
+            auto sig = _sigs.data() + (size_t)id * sz_sig;
+            signature(str, sig);
+            for(int b = 0; b < _bands; ++b)
+                _buckets[b][band_hash(sig, b)].push_back(id);
+        }
+    }
+}
+
+void Similar::clear()
+{
+    _entries.clear();
+    _sigs.clear();
+    _buckets.assign(_bands, {});
+}
+
+size_t Similar::size() const
+{
+    return _entries.size();
+}
+
+std::vector<Similar::Match> Similar::query(u8str str, size_t k, float min_score) const
+{
+    std::vector<Match> ret;
+    if(!str || k < 1 || _entries.empty())
+        return ret;
+    std::u32string cps;
+    Text::u8to32(cps, str);
+    if(cps.empty())
+        return ret;
+
+    const size_t sz_sig = _seeds.size();
+    std::vector<uint32_t> sig(sz_sig);
+    signature(cps, sig.data());
+
+    // 至少有一带完全相同的译文才是候选
+    std::vector<uint32_t> cands;
+    for(int b = 0; b < _bands; ++b)
+    {
+        auto iter = _buckets[b].find(band_hash(sig.data(), b));
+        if(iter != _buckets[b].end())
+            cands.insert(cands.end(), iter->second.begin(), iter->second.end());
+    }
+    std::sort(cands.begin(), cands.end());
+    cands.erase(std::unique(cands.begin(), cands.end()), cands.end());
+
+    // 相同签名的比例即Jaccard相似度的估计
+    for(auto id : cands)
+    {
+        auto other = _sigs.data() + (size_t)id * sz_sig;
+        size_t same = 0;
+        for(size_t i = 0; i < sz_sig; ++i)
+            same += sig[i] == other[i];
+        const float score = (float)same / sz_sig;
+        if(score < min_score)
+            continue;
+        auto& e = _entries[id];
+        ret.push_back({ e.group,&e.item->first,&e.item->second,score });
+    }
+
+    auto cmp = [](const Match& a, const Match& b) { return a.score > b.score; };
+    if(ret.size() > k)
+    {
+        std::partial_sort(ret.begin(), ret.begin() + k, ret.end(), cmp);
+        ret.resize(k);
+    }
+    else
+        std::sort(ret.begin(), ret.end(), cmp);
+    return ret;
+}
+
+void Similar::signature(const std::u32string& str, uint32_t* sig) const
+{
+    const size_t sz_sig = _seeds.size();
+    std::fill(sig, sig + sz_sig, UINT32_MAX);
+    // 短于n的字符串整体作为一个n-gram
+    const size_t n = str.size() < (size_t)_ngram ? str.size() : (size_t)_ngram;
+    for(size_t i = 0; i + n <= str.size(); ++i)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for(size_t j = 0; j < n; ++j)
+        {
+            h ^= (uint32_t)str[i + j];
+            h *= 1099511628211ull;
+        }
+        for(size_t s = 0; s < sz_sig; ++s)
+        {
+            const auto v = (uint32_t)mix(h ^ _seeds[s]);
+            if(v < sig[s]) sig[s] = v;
+        }
+    }
+}
+
+uint64_t Similar::band_hash(const uint32_t* sig, int band) const
+{
+    uint64_t h = (uint64_t)band;
+    for(int r = 0; r < _rows; ++r)
+        h = mix(h ^ sig[band * _rows + r]);
+    return h;
+}
+
+}
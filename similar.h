@@ -0,0 +1,77 @@
+/*
+*******************************************************************************
+    ChenKe404's text library
+*******************************************************************************
+@project	cktext
+@authors	chenke404
+@file	similar.h
+@brief 	near-duplicate translation search
+
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 chenke404
+******************************************************************************
+*/
+
+
+#ifndef CK_SIMILAR_H
+#define CK_SIMILAR_H
+
+/*
+ * 相似译文索引
+ * 以码点n-gram的MinHash签名估算译文之间的Jaccard相似度, 通过LSH分带只比较可能相似的译文
+ * 索引保存的是指向Text中翻译项的指针, 建立索引后修改Text需要重新build
+ */
+
+#include "text.h"
+
+namespace ck
+{
+
+struct Similar
+{
+    using u8str = Text::u8str;
+
+    struct Match
+    {
+        const Text::Group* group;
+        const std::string* src;     // 原文
+        const std::string* trs;     // 译文
+        float score;                // 估算的相似度, 0~1
+    };
+
+    // @ngram n-gram的码点个数
+    // @bands LSH的带数, 带数越多召回越高但候选也越多
+    // @rows 每带的签名个数, 签名总长度为bands*rows
+    Similar(int ngram = 3, int bands = 10, int rows = 4);
+
+    // 为Text中所有非空译文建立索引
+    void build(const Text&);
+    void clear();
+    size_t size() const;
+
+    // 查找与str最相似的k条译文, 按相似度从高到低排列
+    // @min_score 相似度低于该值的结果被忽略
+    std::vector<Match> query(u8str str, size_t k, float min_score = 0) const;
+private:
+    // 计算码点序列的签名, 写入sig
+    void signature(const std::u32string& str, uint32_t* sig) const;
+    uint64_t band_hash(const uint32_t* sig, int band) const;
+private:
+    struct Entry
+    {
+        const Text::Group* group;
+        const Text::Group::container::value_type* item;
+    };
+
+    int _ngram;
+    int _bands;
+    int _rows;
+    std::vector<uint64_t> _seeds;       // 每个MinHash函数的种子
+    std::vector<Entry> _entries;
+    std::vector<uint32_t> _sigs;        // 所有译文的签名, 每条bands*rows个
+    std::vector<std::unordered_map<uint64_t,std::vector<uint32_t>>> _buckets;  // 每带: 带哈希 -> 译文编号
+};
+
+}
+
+#endif // !CK_SIMILAR_H
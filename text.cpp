@@ -19,15 +19,87 @@
 #include <iostream>
 #include <mutex>
 #include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <chrono>
+#include <thread>
 #include <lz4xx.h>
 
 namespace fs = std::filesystem;
 constexpr auto L10KB = 10485760;
+constexpr size_t MAX_REMOVED = 1024;    // 组单独记录版本号的已移除原文的上限
 
 template<typename C>
 inline size_t length(const C* str)
 { return std::char_traits<C>::length(str); }
 
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define CKT_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define CKT_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define CKT_PREFETCH(p)
+#endif
+
+// 带密钥的哈希, SipHash-1-3
+// 使用随机密钥时, 无法从外部构造出大量冲突的原文
+static uint64_t siphash(uint64_t k0, uint64_t k1, const char* str, size_t len)
+{
+    auto rotl = [](uint64_t x, int b) { return (x << b) | (x >> (64 - b)); };
+    uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+    uint64_t v3 = 0x7465646279746573ull ^ k1;
+    auto round = [&] {
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+    };
+
+    auto in = (const uint8_t*)str;
+    const size_t end = len & ~(size_t)7;
+    for(size_t i = 0; i < end; i += 8)
+    {
+        uint64_t m = 0;
+        for(int j = 0; j < 8; ++j)  // 按小端读取, 与平台无关
+            m |= (uint64_t)in[i + j] << (8 * j);
+        v3 ^= m;
+        round();
+        v0 ^= m;
+    }
+    uint64_t b = (uint64_t)len << 56;
+    for(size_t j = 0; j < (len & 7); ++j)
+        b |= (uint64_t)in[end + j] << (8 * j);
+    v3 ^= b;
+    round();
+    v0 ^= b;
+    v2 ^= 0xff;
+    round(); round(); round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// 按locale的排序规则转换字符串, 转换结果按字节比较即与原字符串按locale比较的结果一致
+static std::string collate_key(const std::locale& loc, const std::string& str)
+{
+    auto& col = std::use_facet<std::collate<char>>(loc);
+    return col.transform(str.data(),str.data() + str.size());
+}
+
+// 随机的哈希密钥
+static uint64_t random_seed()
+{
+    static std::atomic<uint64_t> counter { 0 };
+    std::random_device rd;
+    uint64_t seed = ((uint64_t)rd() << 32) ^ rd();
+    // 部分平台的random_device是确定的, 再混入时间和计数
+    seed ^= (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    seed ^= ++counter * 0x9e3779b97f4a7c15ull;
+    return seed;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 /// Text
 //////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -101,6 +173,9 @@ struct writer
     inline writer(std::ofstream* so)
         : _so(so),_ctx(nullptr)
     {}
+    inline writer(buffer_t* buf)
+        : _buf(buf)
+    {}
     inline void attach(ctx_compress* ctx) {
         _so = nullptr;
         _ctx = ctx;
@@ -109,6 +184,11 @@ struct writer
     inline bool write(const uint8_t *data, size_t size){
         if(_ctx)
             return _ctx->update(data,size);
+        else if(_buf)
+        {
+            _buf->insert(_buf->end(),data,data + size);
+            return true;
+        }
         else if(_so)
         {
             const auto before = _so->tellp();
@@ -127,48 +207,52 @@ struct writer
 private:
     std::ofstream* _so = nullptr;
     ctx_compress* _ctx = nullptr;
+    buffer_t* _buf = nullptr;
 };
 
-// 在析构时删除目标文件
-struct temp_guard
+// 文件标志, 位于文件标签之后
+enum : uint8_t
 {
-    temp_guard() = default;
-    inline temp_guard(const std::string& path)
-        : _path(path)
-    {}
+    FLAG_COMPRESS = 0x01,   // 文件标志之后的数据是压缩的
+    FLAG_WIDE = 0x02,       // 长度和个数使用8字节, 否则使用4字节
+    FLAG_CHARSET = 0x04,    // 每个组的翻译项之后保存了译文用到的码点区间
+    FLAG_HASH = 0x08,       // 文件标志之后保存了数据的摘要(8字节), 每个组的最后保存了组的内容哈希(8字节)
+    FLAG_BLOCKS = 0x10,     // 公共部分和每个组各为一块(8字节大小+数据), 分别压缩, 文件末尾是块表
+};
 
-    inline ~temp_guard()
+// 内容哈希使用的固定密钥, 相同的内容在任何进程中都得到相同的哈希
+constexpr uint64_t HASH_K0 = 0x636b746578742d68ull;
+constexpr uint64_t HASH_K1 = 0x6173682d76310000ull;
+
+// 读取长度或个数
+inline uint64_t read_size(ireader& rd, bool wide)
+{
+    uint64_t sz = 0;
+    if(wide)
+        rd.read((uint8_t*)&sz, 8);
+    else
     {
-        if(!_path.empty())
-        {
-            std::error_code ec;
-            fs::remove(_path,ec);
-        }
+        uint32_t v = 0;
+        rd.read((uint8_t*)&v, 4);
+        sz = v;
     }
+    return sz;
+}
 
-    inline void set(const std::string& path)
-    { _path = path; }
-private:
-    std::string _path;
-};
-
-int read_str(ireader& rd, std::string& out)
+size_t read_str(ireader& rd, std::string& out, bool wide = false)
 {
-    int sz = 0;
-    rd.read((uint8_t*)&sz, 4);
+    const auto sz = read_size(rd, wide);
     if (sz < 1 || sz > L10KB)    // 字符串长度不能超过10KB
         return 0;
     out.resize(sz);
-    int pos = 0;
-    int remain = sz;
+    size_t pos = 0;
+    size_t remain = sz;
     while (remain > 0)
     {
-        if (remain > 1024)
-            rd.read((uint8_t*)out.data() + pos, 1024);
-        else
-            rd.read((uint8_t*)out.data() + pos, remain);
-        pos += 1024;
-        remain -= 1024;
+        const size_t step = remain > 1024 ? 1024 : remain;
+        rd.read((uint8_t*)out.data() + pos, step);
+        pos += step;
+        remain -= step;
     }
     return sz;
 }
@@ -301,8 +385,10 @@ void write(ck::writer& wt, const Text::Property& o)
 }
 
 Text::Text()
+    : _samples(std::make_shared<Samples>())
 {
-    _map[""];
+    attach(_map[""]);
+    update_sorted();
 }
 
 void CKT_CALL Text::u8to32(std::u32string& out, u8str in, int len) {
@@ -422,34 +508,233 @@ void CKT_CALL ck::Text::u32to16(std::u16string& out, u32str in, int len) {
     __u32to16<char16_t>(out, in, len);
 }
 
+// 逐个解码码点, 用于不转码直接比较不同编码的字符串
+// 非法或不完整的序列按单个码元处理
+inline char32_t next_u8(const char*& p, const char* end)
+{
+    const uint8_t c = *p++;
+    int n = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    if(n > end - p)
+        return c;
+    char32_t ret = n == 0 ? c : c & (0x3F >> n);
+    for(; n > 0; --n)
+        ret = ret << 6 | (uint8_t(*p++) & 0x3F);
+    return ret;
+}
+
+template<typename C>
+inline char32_t next_ucs(const C*& p, const C* end)
+{
+    char32_t c = (std::make_unsigned_t<C>)*p++;
+    if(sizeof(C) == 2 && c >= 0xD800 && c <= 0xDBFF && p < end && (*p & 0xFC00) == 0xDC00)
+        c = 0x10000 + ((c - 0xD800) << 10 | (*p++ - 0xDC00));
+    return c;
+}
+
+// 以码点顺序比较utf8字符串与utf16/utf32字符串
+// 合法的utf8按字节比较的结果与按码点比较相同, 所以可以在std::map中与原文做异构查找
+template<typename C>
+struct ucs_key
+{
+    std::basic_string_view<C> str;
+
+    static int compare(const std::string& a, std::basic_string_view<C> b)
+    {
+        auto pa = a.data(), ea = pa + a.size();
+        auto pb = b.data(), eb = pb + b.size();
+        while(pa < ea && pb < eb)
+        {
+            const auto ca = next_u8(pa, ea);
+            const auto cb = next_ucs(pb, eb);
+            if(ca != cb)
+                return ca < cb ? -1 : 1;
+        }
+        return (pa < ea) - (pb < eb);
+    }
+
+    friend inline bool operator<(const std::string& a, const ucs_key& b) { return compare(a, b.str) < 0; }
+    friend inline bool operator<(const ucs_key& a, const std::string& b) { return compare(b, a.str) > 0; }
+};
+
+// 限制写入总量的写入器, 超出限制时拒绝写入, 使解压尽早失败
+struct limited_writer : bio::iwriter
+{
+    inline limited_writer(bio::iwriter& wt, size_t limit)
+        : _wt(wt), _limit(limit)
+    {}
+
+    inline size_t write(const uint8_t* data, size_t size) override {
+        if(_limit > 0 && size > _limit - _written)
+        {
+            _exceeded = true;
+            return 0;
+        }
+        const auto ret = _wt.write(data, size);
+        _written += ret;
+        return ret;
+    }
+
+    inline size_t seek(pos_t pos) override { return _wt.seek(pos); }
+    inline size_t pos() const override { return _wt.pos(); }
+    inline size_t offset(pos_t ofs) override { return _wt.offset(ofs); }
+
+    inline bool exceeded() const { return _exceeded; }
+private:
+    bio::iwriter& _wt;
+    size_t _limit = 0;
+    size_t _written = 0;
+    bool _exceeded = false;
+};
+
+// 按需生成数据的读取器, 每次数据用完时调用next生成下一段, next返回false表示结束
+// 压缩时不需要把整个文件的数据放在内存中, 只支持顺序读取
+struct chunked_reader : bio::ireader
+{
+    using Next = std::function<bool(buffer_t&)>;
+
+    inline chunked_reader(const Next& next)
+        : _next(next)
+    {}
+
+    inline size_t read(uint8_t* data, size_t size) override {
+        size_t ret = 0;
+        while(ret < size)
+        {
+            if(_pos == _buf.size())
+            {
+                _buf.clear();
+                _pos = 0;
+                if(!_next || !_next(_buf))
+                {
+                    _next = nullptr;
+                    break;
+                }
+                continue;
+            }
+            const auto n = std::min(size - ret, _buf.size() - _pos);
+            memcpy(data + ret, _buf.data() + _pos, n);
+            _pos += n;
+            ret += n;
+        }
+        _total += ret;
+        return ret;
+    }
+
+    inline size_t seek(pos_t) override { return _total; }
+    inline size_t pos() const override { return _total; }
+    inline size_t offset(pos_t) override { return _total; }
+private:
+    Next _next;
+    buffer_t _buf;
+    size_t _pos = 0;
+    size_t _total = 0;
+};
+
+// 版本号, 所有Text共用一个计数, 保证不同Text的版本号也不重复
+static std::atomic<uint64_t> g_version { 0 };
+
+// 每个翻译项除字符串外的估算内存开销(树节点和两个字符串对象)
+constexpr size_t SZ_ITEM_OVERHEAD = 128;
+
 template<class Rd>
-static inline bool load(Text& that, Rd& _rd)
+static inline bool load(Text& that, Rd& _rd, const Text::Limits& limits)
 {
+    // 超过限制, max为0表示不限制
+    auto exceed = [](uint64_t value, uint64_t max) {
+        return max > 0 && value > max;
+    };
+
     ck::reader<Rd> rd(&_rd);
-    // 读取文件标签和压缩标志
-    bool compressed = true;
+    // 读取文件标签和文件标志
+    uint8_t flags = 0;
     char tag[3];
     rd.read(tag,3);
-    rd.read(&compressed,1);
+    rd.read(&flags,1);
+    const bool compressed = flags & FLAG_COMPRESS;
+    const bool wide = flags & FLAG_WIDE;
+    const bool has_charset = flags & FLAG_CHARSET;
+    const bool has_hash = flags & FLAG_HASH;
     if(strncmp(tag,"CKT",3) != 0)
     {
         std::cerr << "Text::open: illegal file tag! skiped." << std::endl;
         rd.offset(-3);
         return false;
     }
+    // 数据的哈希只用于保存时比较, 加载时跳过
+    if(has_hash)
+    {
+        uint64_t digest = 0;
+        rd.read(&digest,8);
+    }
+
+    const bool blocks = flags & FLAG_BLOCKS;
 
     buffer_t buf;
     lz4xx::reader_buffer rdb(&buf);
-    if (compressed)
+    // 分块的文件: 读取下一块并切换到该块的数据
+    buffer_t stored;
+    uint64_t sz_bytes = 0;
+    auto next_block = [&]() -> bool {
+        uint64_t sz = 0;
+        if(_rd.read((uint8_t*)&sz,8) != 8)
+            return false;
+        // 按实际读到的数据分配, 不信任文件中的大小
+        auto& raw = compressed ? stored : buf;
+        raw.clear();
+        uint8_t chunk[65536];
+        for(uint64_t remain = sz; remain > 0;)
+        {
+            const auto step = (size_t)std::min<uint64_t>(remain,sizeof(chunk));
+            if(_rd.read(chunk,step) != step)
+                return false;
+            raw.insert(raw.end(),chunk,chunk + step);
+            remain -= step;
+        }
+        if(compressed)
+        {
+            buf.clear();
+            lz4xx::reader_buffer rds(&stored);
+            lz4xx::writer_buffer wtb(buf);
+            // 剩余的限制, 已用完时仍需限制为非0值(0表示不限制)
+            const auto remain = limits.max_bytes > sz_bytes ? limits.max_bytes - sz_bytes : 1;
+            limited_writer wtl(wtb, limits.max_bytes > 0 ? remain : 0);
+            if(!lz4xx::decompress(rds, wtl))
+                return false;
+        }
+        sz_bytes += buf.size();
+        if(exceed(sz_bytes,limits.max_bytes))
+            return false;
+        rdb.seek(0);
+        rd.attach(&rdb);
+        return true;
+    };
+
+    if(blocks)
+    {
+        if(!next_block())
+        {
+            std::cerr << "Text::open: failed to read data block! suspended." << std::endl;
+            return false;
+        }
+    }
+    else if (compressed)
     {
         lz4xx::writer_buffer wtb(buf);
-        lz4xx::decompress(rd, wtb);
+        limited_writer wtl(wtb, limits.max_bytes);
+        if(!lz4xx::decompress(rd, wtl))
+        {
+            if(wtl.exceeded())
+                std::cerr << "Text::open: decompressed data exceeds the limit! suspended." << std::endl;
+            else
+                std::cerr << "Text::open: failed to decompress data! suspended." << std::endl;
+            return false;
+        }
         rd.attach(&rdb);
     }
 
-    auto read_attr = [&rd](int sz,Text::Property& attr){
+    auto read_attr = [&rd](uint64_t sz,Text::Property& attr){
         attr.clear();
-        for(int i=0; i<sz; ++i)
+        for(uint64_t i=0; i<sz; ++i)
         {
             if(!read(rd,attr))  // 属性有误, 文件数据可能已被破坏
             {
@@ -461,21 +746,32 @@ static inline bool load(Text& that, Rd& _rd)
     };
 
     // 读属性个数
-    int sz_attr = 0;
-    rd.read(&sz_attr,4);
+    auto sz_attr = read_size(rd,wide);
     // 读组个数
-    int sz_group = 0;
-    rd.read(&sz_group,4);
+    auto sz_group = read_size(rd,wide);
+    if(exceed(sz_group,limits.max_groups))
+    {
+        std::cerr << "Text::open: group count exceeds the limit! suspended." << std::endl;
+        return false;
+    }
     // 读属性
     if(!read_attr(sz_attr,that._prop))
         return false;
 
     bool error = false;
+    uint64_t sz_entries = 0;
+    uint64_t sz_memory = 0;
     std::string name;
     std::string src;
     Text::Group group;
-    for(int i=0; i<sz_group; ++i)
+    for(uint64_t i=0; i<sz_group; ++i)
     {
+        if(blocks && !next_block())
+        {
+            std::cerr << "Text::open: failed to read data block! suspended." << std::endl;
+            error = true;
+            break;
+        }
         // 读组名
         int sz_name = 0;
         rd.read(&sz_name,1);
@@ -494,11 +790,9 @@ static inline bool load(Text& that, Rd& _rd)
         }
 
         // 读属性个数
-        int sz_attr = 0;
-        rd.read(&sz_attr,4);
+        auto sz_attr = read_size(rd,wide);
         // 读翻译个数
-        int sz_item = 0;
-        rd.read(&sz_item,4);
+        auto sz_item = read_size(rd,wide);
         // 读属性
         if(!read_attr(sz_attr,group._prop))
             return false;
@@ -509,24 +803,115 @@ static inline bool load(Text& that, Rd& _rd)
         if(group._priority < 0)
             group._priority = 0;
 
+        // 在读取翻译项之前检查个数, 不信任文件中的个数
+        sz_entries += sz_item;
+        if(exceed(sz_entries,limits.max_entries))
+        {
+            std::cerr << "Text::open: entry count exceeds the limit! suspended." << std::endl;
+            error = true;
+            break;
+        }
+
         // 读取翻译项
         auto& map = group._map;
-        for(int j=0; j<sz_item; ++j)
+        for(uint64_t j=0; j<sz_item; ++j)
         {
-            auto sz = read_str(rd,src);
+            auto sz = read_str(rd,src,wide);
             if(sz < 1)  // 原文必须有长度
             {
                 error = true;
                 break;
             }
             auto& trs = map[src];
-            read_str(rd,trs);
+            read_str(rd,trs,wide);
+            // 边读边累计内存占用, 超出时立即停止
+            sz_memory += src.size() + trs.size() + SZ_ITEM_OVERHEAD;
+            if(exceed(sz_memory,limits.max_memory))
+            {
+                std::cerr << "Text::open: memory usage exceeds the limit! suspended." << std::endl;
+                error = true;
+                break;
+            }
+        }
+        if(error)
+            break;
+
+        // 读取码点区间
+        if(has_charset)
+        {
+            const auto sz_range = read_size(rd,wide);
+            if(sz_range > 0x110000)
+            {
+                std::cerr << "Text::open: illegal charset size was discovered! suspended." << std::endl;
+                error = true;
+                break;
+            }
+            // 码点区间同样计入内存占用
+            sz_memory += sz_range * sizeof(Text::Group::Charset::value_type);
+            if(exceed(sz_memory,limits.max_memory))
+            {
+                std::cerr << "Text::open: memory usage exceeds the limit! suspended." << std::endl;
+                error = true;
+                break;
+            }
+            auto& charset = group._charset;
+            charset.resize(sz_range);
+            for(size_t k = 0; k < charset.size(); ++k)
+            {
+                auto& it = charset[k];
+                rd.read(&it.first,4);
+                rd.read(&it.second,4);
+                // 区间必须有效, 按码点升序且互不相邻
+                if(it.first > it.second || it.second > 0x10FFFF || (k > 0 && it.first <= charset[k - 1].second + 1))
+                {
+                    error = true;
+                    break;
+                }
+            }
+            if(error)
+            {
+                std::cerr << "Text::open: illegal charset range was discovered! suspended." << std::endl;
+                break;
+            }
+            group._charset_valid = true;
+        }
+
+        // 读取组的内容哈希
+        if(has_hash)
+        {
+            rd.read(&group._hash,8);
+            group._hash_valid = true;
         }
 
         auto& _map = that._map;
         auto iter = _map.find(name);
         if(iter == _map.end())  // 插入
-            _map[name] = std::move(group);
+        {
+            auto& grp = _map[name];
+            grp = std::move(group);
+            that.attach(grp);
+        }
+        else if(iter->second._map.empty())  // 已存在的组为空(如默认组), 直接接管读取的翻译项
+        {
+            // 保留文件中的顺序(节点按读取顺序分配), 码点和内容哈希
+            auto& grp = iter->second;
+            grp._map.swap(group._map);
+            grp._charset.swap(group._charset);
+            const bool charset = group._charset_valid;
+            // 与已存在的组合并时不读取属性, 属性都为空时内容哈希才相同
+            const bool hash = group._hash_valid && grp._prop.empty() && group._prop.empty();
+            if(grp._collated)
+            {
+                for(auto& it : grp._map)
+                    it.second.key = collate_key(grp._loc,it.second);
+            }
+            if(grp._folded.on)
+                grp.fold();
+            grp.changed();
+            grp._charset_valid = charset;
+            grp._hash = group._hash;
+            grp._hash_valid = hash;
+        }
         else    // 合并到已存在的组
         {
             for(auto& it : group)
@@ -547,175 +932,778 @@ static inline bool load(Text& that, Rd& _rd)
 }
 
 bool Text::open(const char* filename)
+{
+    return open(filename, Limits());
+}
+
+bool Text::open(const char* filename, const Limits& limits)
 {
     std::ifstream fi(filename, std::ios::binary);
     if (!fi) return false;
     auto rd = make_reader(fi);
-    auto ret = ck::load(*this, rd);
+    auto ret = ck::load(*this, rd, limits);
     fi.close();
     update_sorted();
     return ret;
 }
 
 bool ck::Text::load(const uint8_t* buf, size_t size)
+{
+    return load(buf, size, Limits());
+}
+
+bool ck::Text::load(const uint8_t* buf, size_t size, const Limits& limits)
 {
     auto rd = make_reader(buf, size);
-    auto ret = ck::load(*this, rd);
+    auto ret = ck::load(*this, rd, limits);
     update_sorted();
     return ret;
 }
 
+// 组的内容哈希
+// 与文件格式无关的规范形式: 属性, 然后按原文顺序的 8字节长度+原文 8字节长度+译文
+// @skip 不为空时跳过其中的翻译项
+static uint64_t content_hash(const Text::Property& prop, const Text::Group::container& map,
+    const std::unordered_set<const Text::Group::container::value_type*>* skip = nullptr)
+{
+    buffer_t data;
+    ck::writer wt(&data);
+    write(wt,prop);
+    for(auto& it : map)
+    {
+        if(skip && skip->count(&it))
+            continue;
+        uint64_t sz = it.first.size();
+        wt.write(&sz,8);
+        wt.write(it.first.data(),it.first.size());
+        sz = it.second.size();
+        wt.write(&sz,8);
+        wt.write(it.second.data(),it.second.size());
+    }
+    return siphash(HASH_K0,HASH_K1,(const char*)data.data(),data.size());
+}
+
+// 组的译文用到的码点, 连续的码点合并为区间
+// @skip 不为空时跳过其中的翻译项
+static Text::Group::Charset make_charset(const Text::Group::container& map,
+    const std::unordered_set<const Text::Group::container::value_type*>* skip = nullptr)
+{
+    // 解码所有译文, 收集不重复的码点
+    std::vector<char32_t> cps;
+    for(auto& it : map)
+    {
+        if(skip && skip->count(&it))
+            continue;
+        auto str = (const uint8_t*)it.second.data();
+        const auto len = it.second.size();
+        for(size_t i = 0; i < len;)
+        {
+            const uint8_t c = str[i];
+            char32_t cp = 0;
+            size_t n = 1;
+            if(c < 0x80) cp = c;
+            else if(c >= 0xF8) { ++i; continue; }   // 非法的起始字节
+            else if(c >= 0xF0) { cp = c & 0x07; n = 4; }
+            else if(c >= 0xE0) { cp = c & 0x0F; n = 3; }
+            else if(c >= 0xC0) { cp = c & 0x1F; n = 2; }
+            else { ++i; continue; }
+            if(i + n > len) break;
+            size_t j = 1;
+            for(; j < n && (str[i + j] & 0xC0) == 0x80; ++j)
+                cp = (cp << 6) | (str[i + j] & 0x3F);
+            // 跳过非法的序列, 码点不能超过0x10FFFF(读取时会检查), 也不能是代理项
+            if(j < n || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+            {
+                ++i;
+                continue;
+            }
+            cps.push_back(cp);
+            i += n;
+        }
+    }
+    std::sort(cps.begin(),cps.end());
+    cps.erase(std::unique(cps.begin(),cps.end()),cps.end());
+
+    // 合并连续的码点
+    Text::Group::Charset charset;
+    for(auto cp : cps)
+    {
+        if(!charset.empty() && charset.back().second + 1 == cp)
+            charset.back().second = cp;
+        else
+            charset.push_back({ cp,cp });
+    }
+    return charset;
+}
+
 bool Text::save(const char* filename, bool compress)
 {
-    std::ofstream fo(filename,std::ios::binary);
-    if(!fo.is_open()) return false;
-    ck::writer wt(&fo);
+    SaveOptions opts;
+    opts.compress = compress;
+    return save(filename, opts);
+}
 
-    // 写入"文件标签"和"压缩标志"
-    wt.write("CKT",3);
-    wt.write(&compress,1);
+bool Text::save(const char* filename, const SaveOptions& opts)
+{
+    // 空文件不压缩
+    const bool compress = opts.compress && !empty();
+    // 个数超过4字节能表示的范围时使用8字节
+    bool wide = opts.wide || _map.size() > UINT32_MAX || _prop.size() > UINT32_MAX;
+    for(auto& it : _map)
+        wide = wide || it.second._map.size() > UINT32_MAX;
+    const bool hash = opts.hash || opts.incremental;
+    const bool blocks = opts.blocks || opts.incremental;
+    uint8_t flags = 0;
+    if(compress) flags |= FLAG_COMPRESS;
+    if(wide) flags |= FLAG_WIDE;
+    if(opts.charset) flags |= FLAG_CHARSET;
+    if(hash) flags |= FLAG_HASH;
+    if(blocks) flags |= FLAG_BLOCKS;
+
+    auto write_size = [wide](ck::writer& wt, uint64_t sz) {
+        if(wide)
+            wt.write(&sz,8);
+        else
+        {
+            auto v = (uint32_t)sz;
+            wt.write(&v,4);
+        }
+    };
 
-    // 写属性个数
-    auto sz_attr = _prop.size();
-    wt.write(&sz_attr,4);
-    if(empty())
+    // 文件的公共部分: 属性个数, 组个数, 属性
+    buffer_t head;
     {
-        // 写组个数
-        int sz_group = 0;
-        wt.write(&sz_group,4);
-        // 写属性
+        ck::writer wt(&head);
+        write_size(wt,_prop.size());
+        write_size(wt,empty() ? 0 : _map.size());
         write(wt,_prop);
-        fo.close();
-        return true;
     }
-    else
+
+    // 按访问次数排序, 次数相同的保持原有顺序
+    using item_t = Group::container::value_type;
+    auto heat = [&opts](const std::string& src) -> uint64_t {
+        auto iter = opts.profile->find(src);
+        return iter == opts.profile->end() ? 0 : iter->second;
+    };
+
+    std::unordered_set<const item_t*> pruned;
+    if(opts.prune)
+        shadowed(pruned);
+
+    std::vector<std::pair<const container::value_type*,uint64_t>> groups;
+    if(!empty())
     {
-        // 写组个数
-        auto sz_group = (int)_map.size();
-        fo.write((char*)&sz_group,4);
-        // 写属性
-        write(wt,_prop);
+        groups.reserve(_map.size());
+        for(auto& it : _map)
+        {
+            uint64_t sum = 0;
+            if(opts.profile)
+            {
+                for(auto& item : it.second._map)
+                    sum += heat(item.first);
+            }
+            groups.push_back({ &it,sum });
+        }
+    }
+    if(opts.profile)
+    {
+        std::stable_sort(groups.begin(),groups.end(),[](auto& a,auto& b){
+            return a.second > b.second;
+        });
     }
 
-    size_t sz_name = 0;
-    size_t sz_item = 0;
-    for(auto& it : _map)
+    // 组的内容哈希和块的键(组名+内容哈希), 内容哈希来自文件且组未修改时不需要重新计算
+    // 数据的摘要由公共部分和所有块的键计算, 不需要先生成整个文件的数据
+    std::vector<uint64_t> hashes(groups.size());
+    std::vector<uint64_t> keys(groups.size());
+    uint64_t digest = 0;
+    if(hash || blocks)
     {
+        buffer_t tmp;
+        for(size_t i = 0; i < groups.size(); ++i)
+        {
+            auto& it = *groups[i].first;
+            bool whole = true;
+            if(!pruned.empty())
+            {
+                for(auto& item : it.second._map)
+                {
+                    if(pruned.count(&item))
+                    {
+                        whole = false;
+                        break;
+                    }
+                }
+            }
+            // 移除了翻译项的组按保存的内容计算
+            hashes[i] = whole ? it.second.hash() : content_hash(it.second._prop,it.second._map,&pruned);
+            tmp.assign(it.first.begin(),it.first.end());
+            tmp.insert(tmp.end(),(const uint8_t*)&hashes[i],(const uint8_t*)&hashes[i] + 8);
+            keys[i] = siphash(HASH_K0,HASH_K1,(const char*)tmp.data(),tmp.size());
+        }
+        tmp = head;
+        tmp.insert(tmp.end(),(const uint8_t*)keys.data(),(const uint8_t*)(keys.data() + keys.size()));
+        digest = siphash(HASH_K0,HASH_K1,(const char*)tmp.data(),tmp.size());
+    }
+
+    // 把第i个组序列化到out的末尾
+    std::vector<std::pair<const item_t*,uint64_t>> items;
+    auto serialize = [&](size_t i, buffer_t& out) {
+        ck::writer wt(&out);
+        auto& grp = groups[i];
+        auto& it = *grp.first;
         // 写组名
-        sz_name = (int)it.first.size();
+        size_t sz_name = (int)it.first.size();
         wt.write(&sz_name,1);
         wt.write(it.first.c_str(),sz_name);
 
         auto& attr = it.second._prop;
         // 写属性个数
-        sz_attr = attr.size();
-        wt.write(&sz_attr,4);
-        // 写翻译个数
+        write_size(wt,attr.size());
         auto& map = it.second._map;
-        sz_item = map.size();
-        wt.write(&sz_item,4);
+        items.clear();
+        for(auto& item : map)
+        {
+            if(!pruned.count(&item))
+                items.push_back({ &item,grp.second > 0 ? heat(item.first) : 0 });
+        }
+        // 写翻译个数
+        write_size(wt,items.size());
         // 写属性
         write(wt,attr);
+
+        if(grp.second > 0)
+        {
+            std::stable_sort(items.begin(),items.end(),[](auto& a,auto& b){
+                return a.second > b.second;
+            });
+        }
+
         // 写翻译项
-        for(auto& it : map)
+        for(auto& item : items)
         {
+            auto& it = *item.first;
             // 原文
-            auto sz = (int)it.first.size();
-            fo.write((char*)&sz,4);
-            fo.write(it.first.data(),sz);
+            write_size(wt,it.first.size());
+            wt.write(it.first.data(),it.first.size());
             // 译文
-            sz = (int)it.second.size();
-            fo.write((char*)&sz,4);
-            fo.write(it.second.data(),sz);
+            write_size(wt,it.second.size());
+            wt.write(it.second.data(),it.second.size());
         }
-    }
-
-    fo.close();
 
-    if(compress)
-    {
-        std::error_code ec;
-        std::string path(filename);
-        path.append(".cop");
-        fo.open(path,std::ios::binary);
-        if(!fo.is_open())
-        {
-            std::cerr << "Text::save: can't create cop file:" << path << std::endl;
-            fs::remove(filename,ec);
-            return false;
-        }
-        temp_guard tg(path);
-        std::ifstream fi(filename, std::ios::binary);
-        if(!fi.is_open())
+        // 写码点区间
+        if(opts.charset)
         {
-            std::cerr << "Text::save: can't open ckt file:" << filename << std::endl;
-            return false;
+            // 移除了翻译项的组只统计保存的译文
+            Group::Charset part;
+            if(items.size() != map.size())
+                part = make_charset(map,&pruned);
+            auto& charset = items.size() != map.size() ? part : it.second.charset();
+            write_size(wt,charset.size());
+            for(auto& range : charset)
+            {
+                wt.write(&range.first,4);
+                wt.write(&range.second,4);
+            }
         }
-        // 不压缩"文件标签"和"压缩标志"
-        fi.seekg(4);
-        // 写入"文件标签"和"压缩标志"
-        fo.write("CKT",3);
-        fo.write((char*)&compress,1);
 
-        lz4xx::progress pgs;
-        lz4xx::reader_stream rd(fi);
-        lz4xx::writer_stream wt(fo);
-        lz4xx::preferences pfs;
-        pfs.frame.blockSize = lz4xx::BS_Max1MB;
-        if(!lz4xx::compress(rd,wt,&pgs,pfs))
+        // 写组的内容哈希
+        if(hash)
+            wt.write(&hashes[i],8);
+    };
+
+    // 增量保存: 读取旧文件的块表, 文件标志相同时内容相同的块可以直接复制
+    // 按访问统计排序时块的内容还取决于访问次数, 不复用
+    std::map<uint64_t,std::pair<uint64_t,uint64_t>> reuse;  // 块的键 -> 偏移, 压缩后的大小
+    std::ifstream fi;
+    if(opts.incremental && !opts.profile)
+    {
+        fi.open(filename,std::ios::binary);
+        char hd[12] = {};
+        if(fi.is_open() && fi.read(hd,12) && strncmp(hd,"CKT",3) == 0 && (uint8_t)hd[3] == flags)
         {
-            std::cerr << "Text::open: failed to write ckt file:" << pgs.last_error << std::endl;
-            return false;
+            if(memcmp(hd + 4,&digest,8) == 0)
+                return true;    // 内容没有变化, 保留原文件
+
+            // 文件末尾: 块表(每块 键,偏移,大小 各8字节), 块数(8字节), 块表的偏移(8字节)
+            fi.seekg(0,std::ios::end);
+            const uint64_t sz_file = fi.tellg();
+            uint64_t count = 0, ofs = 0;
+            if(sz_file >= 28 && fi.seekg(sz_file - 16) && fi.read((char*)&count,8) && fi.read((char*)&ofs,8)
+                && ofs >= 12 && count <= (sz_file - 16 - ofs) / 24 && ofs + count * 24 == sz_file - 16)
+            {
+                fi.seekg(ofs);
+                for(uint64_t i = 0; i < count; ++i)
+                {
+                    uint64_t ent[3] = {};
+                    if(!fi.read((char*)ent,24))
+                        break;
+                    if(ent[1] >= 12 && ent[2] <= sz_file && ent[1] + 8 + ent[2] <= ofs)
+                        reuse[ent[0]] = { ent[1],ent[2] };
+                }
+            }
         }
-        fi.close();
-        fo.close();
-        fs::remove(filename,ec);
-        fs::rename(path,filename,ec);
+        fi.clear();
     }
 
-    return true;
-}
+    // 复用旧文件时先写到临时文件, 完成后替换
+    const bool replace = !reuse.empty();
+    std::string path(filename);
+    if(replace)
+        path.append(".tmp");
+    std::ofstream fo(path,std::ios::binary);
+    if(!fo.is_open()) return false;
+    auto fail = [&](const char* msg, const std::string& err) {
+        std::cerr << "Text::save: " << msg << err << std::endl;
+        fo.close();
+        std::error_code ec;
+        fs::remove(path,ec);
+        return false;
+    };
 
-const char* g_empty = "";
-u8str Text::u8(u8str src,u8str def) const
-{
-    if(!src) return nullptr;
-    u8str trs = nullptr;
-    for(auto& it : _sorted)
+    // 写入"文件标签"和"文件标志"
+    fo.write("CKT",3);
+    fo.write((char*)&flags,1);
+    if(hash)
+        fo.write((char*)&digest,8);
+
+    lz4xx::progress pgs;
+    lz4xx::preferences pfs;
+    pfs.frame.blockSize = lz4xx::BS_Max1MB;
+    buffer_t gbuf;
+    if(blocks)
     {
-        trs = it->u8(src,g_empty);
-        if(trs)
+        // 每块: 8字节大小 + 数据, 压缩时每块单独压缩
+        buffer_t cbuf;
+        auto write_block = [&](buffer_t& raw) -> uint64_t {
+            buffer_t* data = &raw;
+            if(compress)
+            {
+                cbuf.clear();
+                lz4xx::reader_buffer rd(&raw);
+                lz4xx::writer_buffer wt(cbuf);
+                if(!lz4xx::compress(rd,wt,&pgs,pfs))
+                    return UINT64_MAX;
+                data = &cbuf;
+            }
+            const uint64_t sz = data->size();
+            fo.write((char*)&sz,8);
+            fo.write((const char*)data->data(),sz);
+            return sz;
+        };
+        // 从旧文件复制内容相同的块, 先完整读出再写入, 失败时不影响输出
+        auto copy_block = [&](uint64_t ofs, uint64_t sz) -> bool {
+            uint64_t prefix = 0;
+            cbuf.resize(sz);
+            if(!fi.seekg(ofs) || !fi.read((char*)&prefix,8) || prefix != sz || !fi.read((char*)cbuf.data(),sz))
+            {
+                fi.clear();
+                return false;
+            }
+            fo.write((char*)&sz,8);
+            fo.write((const char*)cbuf.data(),sz);
+            return true;
+        };
+
+        if(write_block(head) == UINT64_MAX)
+            return fail("failed to compress ckt file:",pgs.last_error);
+        std::vector<uint64_t> table;
+        table.reserve(groups.size() * 3);
+        for(size_t i = 0; i < groups.size(); ++i)
         {
-            if(trs == g_empty)  // 说明原文存在但译文不存在
-                return def;
+            const uint64_t ofs = fo.tellp();
+            uint64_t sz = 0;
+            auto iter = reuse.find(keys[i]);
+            if(iter != reuse.end() && copy_block(iter->second.first,iter->second.second))
+                sz = iter->second.second;
             else
-                return trs;
+            {
+                gbuf.clear();
+                serialize(i,gbuf);
+                sz = write_block(gbuf);
+                if(sz == UINT64_MAX)
+                    return fail("failed to compress ckt file:",pgs.last_error);
+            }
+            table.insert(table.end(),{ keys[i],ofs,sz });
         }
+        // 块表
+        const uint64_t ofs_table = fo.tellp();
+        const uint64_t count = groups.size();
+        fo.write((const char*)table.data(),table.size() * 8);
+        fo.write((const char*)&count,8);
+        fo.write((const char*)&ofs_table,8);
     }
-    return def;
-}
-
-u32str Text::u32(u8str src,u8str def) const
-{
-    if(!src) return nullptr;
+    else if(compress)
+    {
+        // 逐组生成数据交给压缩器, 内存中最多只有一个组的数据
+        size_t next = 0;
+        chunked_reader rd([&](buffer_t& out) {
+            if(next > groups.size())
+                return false;
+            if(next == 0)
+                out = head;
+            else
+                serialize(next - 1,out);
+            ++next;
+            return true;
+        });
+        lz4xx::writer_stream wt(fo);
+        if(!lz4xx::compress(rd,wt,&pgs,pfs))
+            return fail("failed to write ckt file:",pgs.last_error);
+    }
+    else
+    {
+        fo.write((const char*)head.data(),head.size());
+        for(size_t i = 0; i < groups.size(); ++i)
+        {
+            gbuf.clear();
+            serialize(i,gbuf);
+            fo.write((const char*)gbuf.data(),gbuf.size());
+        }
+    }
+
+    fi.close();
+    fo.close();
+    if(!fo)
+        return fail("failed to write ckt file:",path);
+    if(replace)
+    {
+        std::error_code ec;
+        fs::rename(path,filename,ec);
+        if(ec)
+            return fail("can't replace ckt file:",filename);
+    }
+    return true;
+}
+
+Text::Result Text::lookup(u8str src) const
+{
+    Result ret;
+    if(!src) return ret;
+    for(auto& it : _sorted)
+    {
+        auto item = it->find(src);
+        if(!item)
+            continue;
+        record(src);
+        const auto& trs = item->second;
+        ret.str = std::string_view(trs.c_str(),trs.size());
+        ret.group = it;
+        ret.priority = it->_priority;
+        ret.empty = trs.empty();
+        break;
+    }
+    return ret;
+}
+
+u8str Text::u8(u8str src,u8str def) const
+{
+    if(!src) return nullptr;
+    auto ret = lookup(src);
+    if(!ret.group || ret.empty)  // 原文不存在 或 原文存在但译文不存在
+        return def;
+    return ret.str.data();
+}
+
+Text::KeyId Text::intern(u8str src)
+{
+    KeyId ret;
+    if(!src) return ret;
+    auto it = _interned_index.find(src);
+    if(it != _interned_index.end())
+    {
+        ret.index = it->second;
+        return ret;
+    }
+    ret.index = (uint32_t)_interned.size();
+    auto& e = _interned.emplace_back();
+    e.src = src;
+    _interned_index.emplace(e.src, ret.index);
+    return ret;
+}
+
+Text::Result Text::lookup(KeyId id) const
+{
+    if(id.index >= _interned.size())
+        return {};
+    const auto& e = _interned[id.index];
+    const auto version = _version;
+    if(e.version.load(std::memory_order_acquire) != version)
+    {
+        // 第一次查询或Text已修改, 重新解析; 其他线程看到新的版本号时结果已经写好
+        std::lock_guard<std::mutex> lock(_mtx_interned);
+        if(e.version.load(std::memory_order_relaxed) != version)
+        {
+            e.result = lookup(e.src.c_str());
+            e.version.store(version, std::memory_order_release);
+            return e.result;
+        }
+    }
+    if(e.result)
+        record(e.src.c_str());
+    return e.result;
+}
+
+template<class C>
+Text::Result Text::lookup_ucs(std::basic_string_view<C> src) const
+{
+    Result ret;
+    for(auto& it : _sorted)
+    {
+        auto item = it->find(src);
+        if(!item)
+            continue;
+        record(item->first.c_str());
+        const auto& trs = item->second;
+        ret.str = std::string_view(trs.c_str(),trs.size());
+        ret.group = it;
+        ret.priority = it->_priority;
+        ret.empty = trs.empty();
+        break;
+    }
+    return ret;
+}
+
+Text::Result Text::lookup(std::u16string_view src) const
+{
+    return lookup_ucs(src);
+}
+
+Text::Result Text::lookup(std::u32string_view src) const
+{
+    return lookup_ucs(src);
+}
+
+Text::Result Text::lookup(std::wstring_view src) const
+{
+    return lookup_ucs(src);
+}
+
+u8str Text::u8(std::u16string_view src, u8str def) const
+{
+    auto ret = lookup(src);
+    if(!ret.group || ret.empty)
+        return def;
+    return ret.str.data();
+}
+
+u8str Text::u8(std::u32string_view src, u8str def) const
+{
+    auto ret = lookup(src);
+    if(!ret.group || ret.empty)
+        return def;
+    return ret.str.data();
+}
+
+u8str Text::u8(std::wstring_view src, u8str def) const
+{
+    auto ret = lookup(src);
+    if(!ret.group || ret.empty)
+        return def;
+    return ret.str.data();
+}
+
+u8str Text::u8(KeyId id, u8str def) const
+{
+    auto ret = lookup(id);
+    if(!ret.group || ret.empty)  // 原文不存在 或 原文存在但译文不存在
+        return def;
+    return ret.str.data();
+}
+
+u32str Text::u32(u8str src,u8str def) const
+{
+    if(!src) return nullptr;
+    auto ret = lookup(src);
+    if(!ret.group)
+        return nullptr;
+
     static std::u32string u32str;
     static std::mutex mtx;
     std::lock_guard<std::mutex> lock(mtx);
+    if(ret.empty)  // 说明原文存在但译文不存在
+        u8to32(u32str, def);
+    else
+        u8to32(u32str, ret.str.data(), (int)ret.str.size());
+    return u32str.c_str();
+}
 
-    u8str trs = nullptr;
-    for(auto& it : _sorted)
+// 访问采样的缓冲
+// 线程第一次采中时登记自己的缓冲, 之后只在自己的缓冲中累加, 锁不会被其他查询线程争用
+struct Text::Samples
+{
+    struct Shard
     {
-        trs = it->u8(src,g_empty);
-        if(trs)
+        std::mutex mtx;
+        Profile counts;
+    };
+    std::mutex mtx;
+    std::vector<std::shared_ptr<Shard>> shards;
+    Profile retired;    // 已退出线程的统计
+
+    // 合并已退出线程的缓冲, 需要持有mtx
+    void collect()
+    {
+        for(auto it = shards.begin(); it != shards.end();)
         {
-            if(trs == g_empty)  // 说明原文存在但译文不存在
-                u8to32(u32str, def);
-            else
-                u8to32(u32str, trs);
-            return u32str.c_str();
+            // 只剩这里的引用, 线程已退出, 不会再写入
+            if(it->use_count() > 1)
+            {
+                ++it;
+                continue;
+            }
+            for(auto& item : (*it)->counts)
+                retired[item.first] += item.second;
+            it = shards.erase(it);
         }
     }
-    return nullptr;
+};
+
+// 下一次采样前跳过的查询次数
+// 服从几何分布, 每次查询被采中的概率为1/rate, 不会与周期性的查询模式同步
+static uint64_t next_skip(uint32_t rate)
+{
+    if(rate < 2) return 0;
+    thread_local uint64_t state = random_seed() | 1;
+    // xorshift64
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    const double u = ((state >> 11) + 0.5) / 9007199254740992.0;   // (0,1)
+    return (uint64_t)(std::log(u) / std::log1p(-1.0 / rate));
+}
+
+void Text::sample(uint32_t rate)
+{
+    _rate = rate;
+}
+
+Text::Profile Text::profile() const
+{
+    std::lock_guard<std::mutex> lock(_samples->mtx);
+    _samples->collect();
+    Profile out = _samples->retired;
+    for(auto& shard : _samples->shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mtx);
+        for(auto& it : shard->counts)
+            out[it.first] += it.second;
+    }
+    return out;
+}
+
+void Text::reset_profile()
+{
+    std::lock_guard<std::mutex> lock(_samples->mtx);
+    _samples->collect();
+    _samples->retired.clear();
+    for(auto& shard : _samples->shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mtx);
+        shard->counts.clear();
+    }
+}
+
+bool Text::save_profile(const char* filename, const Profile& profile)
+{
+    std::ofstream fo(filename,std::ios::binary);
+    if(!fo.is_open()) return false;
+    ck::writer wt(&fo);
+    // 文件标签
+    wt.write("CKP",3);
+    // 统计项个数
+    auto sz = (uint32_t)profile.size();
+    wt.write(&sz,4);
+    for(auto& it : profile)
+    {
+        // 原文
+        sz = (uint32_t)it.first.size();
+        wt.write(&sz,4);
+        wt.write(it.first.data(),sz);
+        // 访问次数
+        wt.write(&it.second,4);
+    }
+    fo.close();
+    return !fo.fail();
+}
+
+bool Text::load_profile(const char* filename, Profile& out)
+{
+    std::ifstream fi(filename, std::ios::binary);
+    if (!fi) return false;
+    auto rd = make_reader(fi);
+    char tag[3];
+    rd.read((uint8_t*)tag,3);
+    if(strncmp(tag,"CKP",3) != 0)
+    {
+        std::cerr << "Text::load_profile: illegal file tag!" << std::endl;
+        return false;
+    }
+    uint32_t sz_item = 0;
+    rd.read((uint8_t*)&sz_item,4);
+    std::string src;
+    for(uint32_t i=0; i<sz_item; ++i)
+    {
+        if(read_str(rd,src) < 1)
+        {
+            std::cerr << "Text::load_profile: illegal source length was discovered! suspended." << std::endl;
+            return false;
+        }
+        uint32_t count = 0;
+        rd.read((uint8_t*)&count,4);
+        out[src] += count;
+    }
+    return true;
+}
+
+void Text::record(u8str src) const
+{
+    const auto rate = _rate.load(std::memory_order_relaxed);
+    if(rate < 1) return;
+    thread_local uint32_t last = 0;
+    thread_local uint64_t skip = 0;
+    if(last != rate)   // 间隔变化后重新抽取
+    {
+        last = rate;
+        skip = next_skip(rate);
+    }
+    if(skip > 0)
+    {
+        --skip;
+        return;
+    }
+    skip = next_skip(rate);
+
+    // 本线程在各个Text中的缓冲, Text析构后对应的项失效
+    using Shard = Samples::Shard;
+    thread_local std::vector<std::pair<std::weak_ptr<Samples>,std::shared_ptr<Shard>>> local;
+    Shard* shard = nullptr;
+    for(auto it = local.begin(); it != local.end();)
+    {
+        if(it->first.expired())
+        {
+            it = local.erase(it);
+            continue;
+        }
+        if(!it->first.owner_before(_samples) && !_samples.owner_before(it->first))
+        {
+            shard = it->second.get();
+            break;
+        }
+        ++it;
+    }
+    if(!shard)
+    {
+        auto ptr = std::make_shared<Shard>();
+        {
+            std::lock_guard<std::mutex> lock(_samples->mtx);
+            _samples->shards.push_back(ptr);
+        }
+        local.push_back({ _samples,ptr });
+        shard = ptr.get();
+    }
+    std::lock_guard<std::mutex> lock(shard->mtx);
+    ++shard->counts[src];
 }
 
 bool Text::rename(const char *oldName, const char *newName)
@@ -723,15 +1711,17 @@ bool Text::rename(const char *oldName, const char *newName)
     auto it = _map.extract(oldName);
     if(!it) return false;
     it.key() = newName;
-    bool flag = true;
-    if(!_map.insert(std::move(it)).inserted)
+    auto ret = _map.insert(std::move(it));
+    if(!ret.inserted)
     {
-        flag = false;
-        // 重命名失败, 还原
-        it.key() = oldName;
-        _map.insert(std::move(it));
+        // 重命名失败, 还原, 失败时节点在ret.node中
+        ret.node.key() = oldName;
+        _map.insert(std::move(ret.node));
+        return false;
     }
-    return flag;
+    // 优先级相同的组按组名排序, 需要重新生成查询顺序
+    update_sorted();
+    return true;
 }
 
 Text::Property &Text::prop()
@@ -781,6 +1771,7 @@ void Text::clear()
             ++i;
             continue;
         }
+        detach(i->second);
         i = _map.erase(i);
     }
     _map.begin()->second.clear();
@@ -792,7 +1783,14 @@ void Text::remove(const char *group)
     if(!group) return;
     const auto len = length(group);
     if(len > 0)
-        _map.erase(group);
+    {
+        auto iter = _map.find(group);
+        if(iter != _map.end())
+        {
+            detach(iter->second);
+            _map.erase(iter);
+        }
+    }
     else    // 如果是移除默认组, 则只是删除默认组的项, 保留组本身
     {
         auto iter = _map.find(group);
@@ -804,11 +1802,40 @@ void Text::remove(const char *group)
 
 Text::iterator Text::remove(iterator it)
 {
+    detach(it->second);
     auto ret = _map.erase(it);
     update_sorted();
     return ret;
 }
 
+size_t Text::remove_groups_if(const std::function<bool(const std::string&, const Group&)>& pred)
+{
+    if(!pred) return 0;
+    size_t count = 0;
+    for(auto i = _map.begin(); i != _map.end();)
+    {
+        if(!pred(i->first,i->second))
+        {
+            ++i;
+            continue;
+        }
+        ++count;
+        if(i->first.empty())    // 保留默认组本身
+        {
+            i->second.clear();
+            ++i;
+        }
+        else
+        {
+            detach(i->second);
+            i = _map.erase(i);
+        }
+    }
+    if(count > 0)
+        update_sorted();
+    return count;
+}
+
 Text::Group* Text::insert(const char *group, const Property& prop)
 {
     if(!group) return nullptr;
@@ -825,6 +1852,7 @@ Text::Group* Text::insert(const char *group, const Property& prop)
         return nullptr;
     }
     auto& grp = ret.first->second;
+    attach(grp);
     grp._prop = prop;
     auto var = prop.get("priority");
     if(var.type() == var::TP_INT)
@@ -845,15 +1873,435 @@ Text::iterator Text::end() const
     return _map.end();
 }
 
+void Text::freeze()
+{
+    for(auto& it : _map)
+        it.second.freeze();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Text::Effective
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// std::*_heap是最大堆, 所以反过来比较
+bool Text::Effective::iterator::greater(const Cursor& a, const Cursor& b)
+{
+    const int c = a.cur->first.compare(b.cur->first);
+    return c > 0 || (c == 0 && a.rank > b.rank);
+}
+
+Text::Effective Text::effective() const
+{
+    Effective ret;
+    ret._text = this;
+    return ret;
+}
+
+Text::Effective::iterator Text::Effective::begin() const
+{
+    iterator ret;
+    uint32_t rank = 0;
+    for(auto grp : _text->_sorted)
+    {
+        if(!grp->empty())
+            ret._heap.push_back({ grp->begin(),grp->end(),grp,rank });
+        ++rank;
+    }
+    std::make_heap(ret._heap.begin(),ret._heap.end(),iterator::greater);
+    ret.next();
+    return ret;
+}
+
+Text::Effective::iterator Text::Effective::end() const
+{
+    return iterator();
+}
+
+Text::Effective::iterator& Text::Effective::iterator::operator++()
+{
+    next();
+    return *this;
+}
+
+void Text::Effective::iterator::next()
+{
+    if(_heap.empty())
+    {
+        _entry = Entry();
+        return;
+    }
+    // 堆顶是最小的原文中优先级最高的组
+    auto& top = _heap.front();
+    const auto& grp = *top.cur;
+    _entry.src = &grp.first;
+    _entry.trs = &grp.second;
+    _entry.group = top.group;
+    // 移动所有位于该原文上的游标
+    while(!_heap.empty() && _heap.front().cur->first == *_entry.src)
+    {
+        std::pop_heap(_heap.begin(),_heap.end(),greater);
+        auto& c = _heap.back();
+        if(++c.cur == c.end)
+            _heap.pop_back();
+        else
+            std::push_heap(_heap.begin(),_heap.end(),greater);
+    }
+}
+
+void Text::shadowed(std::unordered_set<const Group::container::value_type*>& out) const
+{
+    // 与Effective相同的多路归并, 同一原文中堆顶是查询时返回的翻译项, 其余的永远不会被查询到
+    using iterator = Effective::iterator;
+    std::vector<iterator::Cursor> heap;
+    uint32_t rank = 0;
+    for(auto grp : _sorted)
+    {
+        if(!grp->empty())
+            heap.push_back({ grp->begin(),grp->end(),grp,rank });
+        ++rank;
+    }
+    std::make_heap(heap.begin(),heap.end(),iterator::greater);
+    while(!heap.empty())
+    {
+        const auto& src = heap.front().cur->first;
+        bool first = true;
+        while(!heap.empty() && heap.front().cur->first == src)
+        {
+            std::pop_heap(heap.begin(),heap.end(),iterator::greater);
+            auto& c = heap.back();
+            if(!first)
+                out.insert(&*c.cur);
+            first = false;
+            if(++c.cur == c.end)
+                heap.pop_back();
+            else
+                std::push_heap(heap.begin(),heap.end(),iterator::greater);
+        }
+    }
+}
+
+size_t Text::prune()
+{
+    std::unordered_set<const Group::container::value_type*> items;
+    shadowed(items);
+    if(items.empty())
+        return 0;
+    // remove_if传入的是翻译项中的原文, 以其地址识别翻译项
+    std::unordered_set<const std::string*> srcs;
+    srcs.reserve(items.size());
+    for(auto it : items)
+        srcs.insert(&it->first);
+    size_t count = 0;
+    for(auto grp : _sorted)
+    {
+        count += grp->remove_if([&srcs](const std::string& src, const std::string&) {
+            return srcs.count(&src) > 0;
+        });
+    }
+    return count;
+}
+
+void Text::flatten()
+{
+    Group::container merged;
+    for(auto grp : _sorted)
+    {
+        for(auto& it : grp->_map)
+            merged.emplace(it.first,it.second);   // 已存在的原文不会被覆盖
+    }
+
+    remove_groups_if([](const std::string& name, const Group&) {
+        return !name.empty();
+    });
+    auto& grp = _map[""];
+    grp._map.swap(merged);
+    // 重建依赖翻译项的索引
+    if(grp._collated)
+    {
+        for(auto& it : grp._map)
+            it.second.key = collate_key(grp._loc,it.second);
+    }
+    if(grp._folded.on)
+        grp.fold();
+    grp.changed();
+}
+
+void Text::fold()
+{
+    for(auto& it : _map)
+        it.second.fold();
+}
+
+Text::Result Text::lookup_fold(u8str src) const
+{
+    Result ret;
+    if(!src) return ret;
+    std::string key;
+    u8fold(key,src);
+    for(auto& it : _sorted)
+    {
+        auto item = it->_folded.on ? it->find_folded(key) : it->find(src);
+        if(!item)
+            continue;
+        record(item->first.c_str());
+        const auto& trs = item->second;
+        ret.str = std::string_view(trs.c_str(),trs.size());
+        ret.group = it;
+        ret.priority = it->_priority;
+        ret.empty = trs.empty();
+        break;
+    }
+    return ret;
+}
+
+u8str Text::u8_fold(u8str src, u8str def) const
+{
+    auto ret = lookup_fold(src);
+    if(!ret.group || ret.empty)
+        return def;
+    return ret.str.data();
+}
+
+void CKT_CALL Text::parallel(size_t n, const std::function<void(size_t)>& task)
+{
+    if(n < 1) return;
+    size_t sz_thread = std::thread::hardware_concurrency();
+    if(sz_thread < 1) sz_thread = 1;
+    if(sz_thread > n) sz_thread = n;
+
+    std::atomic<size_t> next { 0 };
+    std::exception_ptr error;
+    std::mutex mtx;
+    auto run = [&] {
+        for(size_t i = next++; i < n; i = next++)
+        {
+            try {
+                task(i);
+            }
+            catch(...) {
+                std::lock_guard<std::mutex> lock(mtx);
+                if(!error) error = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < sz_thread; ++i)
+        threads.emplace_back(run);
+    run();
+    for(auto& it : threads)
+        it.join();
+    if(error)
+        std::rethrow_exception(error);
+}
+
+// 把所有翻译项分为若干块, 块数是线程数的若干倍以均衡负载
+template<class G, class Item>
+static void partition(std::vector<std::pair<G*,Item*>>& items, std::vector<size_t>& chunks)
+{
+    size_t sz_thread = std::thread::hardware_concurrency();
+    if(sz_thread < 1) sz_thread = 1;
+    const size_t sz_chunk = std::max<size_t>(256, items.size() / (sz_thread * 8) + 1);
+    chunks.clear();
+    for(size_t i = 0; i < items.size(); i += sz_chunk)
+        chunks.push_back(i);
+    chunks.push_back(items.size());
+}
+
+void Text::transform(const Transform& fn, const Executor& executor)
+{
+    if(!fn) return;
+    std::vector<std::pair<Group*,Group::container::value_type*>> items;
+    for(auto& grp : _map)
+    {
+        for(auto& it : grp.second._map)
+            items.push_back({ &grp.second,&it });
+    }
+    std::vector<size_t> chunks;
+    partition(items,chunks);
+
+    auto task = [&](size_t c) {
+        for(size_t i = chunks[c]; i < chunks[c + 1]; ++i)
+        {
+            auto grp = items[i].first;
+            auto& it = *items[i].second;
+            fn(*grp,it.first,it.second);
+            // 排序键在翻译项中, 可以并行
+            if(grp->_collated)
+                it.second.key = collate_key(grp->_loc,it.second);
+        }
+    };
+    if(executor)
+        executor(chunks.size() - 1,task);
+    else
+        parallel(chunks.size() - 1,task);
+
+    for(auto& grp : _map)
+        grp.second.changed();
+}
+
+void Text::for_each_parallel(const Visitor& fn, const Executor& executor) const
+{
+    if(!fn) return;
+    std::vector<std::pair<const Group*,const Group::container::value_type*>> items;
+    for(auto& grp : _map)
+    {
+        for(auto& it : grp.second._map)
+            items.push_back({ &grp.second,&it });
+    }
+    std::vector<size_t> chunks;
+    partition(items,chunks);
+
+    auto task = [&](size_t c) {
+        for(size_t i = chunks[c]; i < chunks[c + 1]; ++i)
+            fn(*items[i].first,items[i].second->first,items[i].second->second);
+    };
+    if(executor)
+        executor(chunks.size() - 1,task);
+    else
+        parallel(chunks.size() - 1,task);
+}
+
+bool Text::collate(const char* locale)
+{
+    for(auto& it : _map)
+    {
+        if(!it.second.collate(locale))
+            return false;
+    }
+    return true;
+}
+
+const std::string* Text::sortkey(u8str src) const
+{
+    if(!src) return nullptr;
+    for(auto& it : _sorted)
+    {
+        if(it->find(src))
+            return it->sortkey(src);
+    }
+    return nullptr;
+}
+
+Text::GroupHandle Text::handle(const char* group) const
+{
+    auto grp = get(group);
+    return grp ? grp->handle() : GroupHandle();
+}
+
+Text::Group* Text::get(GroupHandle h)
+{
+    if(h.index >= _slots.size() || _slots[h.index].generation != h.generation)
+        return nullptr;
+    return _slots[h.index].group;
+}
+
+const Text::Group* Text::get(GroupHandle h) const
+{
+    if(h.index >= _slots.size() || _slots[h.index].generation != h.generation)
+        return nullptr;
+    return _slots[h.index].group;
+}
+
+void Text::attach(Group& grp)
+{
+    uint32_t index = 0;
+    if(_free.empty())
+    {
+        index = (uint32_t)_slots.size();
+        _slots.push_back({ nullptr,0 });
+    }
+    else
+    {
+        index = _free.back();
+        _free.pop_back();
+    }
+    auto& slot = _slots[index];
+    slot.group = &grp;
+    grp._owner.handle = { index,slot.generation };
+    grp._owner.text = this;
+    grp._owner.group = &grp;
+}
+
+void Text::detach(const Group& grp)
+{
+    const auto index = grp._owner.handle.index;
+    if(index >= _slots.size() || _slots[index].group != &grp)
+        return;
+    auto& slot = _slots[index];
+    slot.group = nullptr;
+    ++slot.generation;  // 使旧句柄失效
+    _free.push_back(index);
+}
+
+uint64_t Text::version() const
+{
+    return _version;
+}
+
+void Text::touch()
+{
+    _version = ++g_version;
+}
+
+Text::u8str Text::u8_literal(u8str src, u8str def) const
+{
+    if(!src) return nullptr;
+    struct entry
+    {
+        const Text* text;
+        u8str key;
+        uint64_t version;
+        Result result;
+    };
+    // 每个线程一份直接映射的缓存, 不需要加锁
+    thread_local entry cache[256] = {};
+    const auto addr = (uintptr_t)src;
+    auto& e = cache[((addr >> 4) ^ (addr >> 12)) & 255];
+    if(e.text != this || e.key != src || e.version != _version)
+    {
+        e.text = this;
+        e.key = src;
+        e.version = _version;
+        e.result = lookup(src);
+    }
+    else if(e.result)
+        record(src);
+    if(!e.result.group || e.result.empty)   // 原文不存在 或 原文存在但译文不存在
+        return def;
+    return e.result.str.data();
+}
+
+void Text::listen(const Listener& fn)
+{
+    _listener = fn;
+}
+
+void Text::notify(const Group* group, const std::string* src, uint64_t version) const
+{
+    if(_listener)
+        _listener(group,src,version);
+}
+
+uint64_t Text::version(u8str src) const
+{
+    auto ret = _layout;
+    for(auto grp : _sorted)
+        ret = std::max(ret,grp->version(src));
+    return ret;
+}
+
 void Text::update_sorted()
 {
+    touch();
+    _layout = _version;
     _sorted.clear();
     for(auto& it : _map){
         _sorted.push_back(&it.second);
     }
-    std::sort(_sorted.begin(),_sorted.end(),[](Group* a,Group* b){
-        return a->_priority > b->_priority || (a->_priority == b->_priority && a < b);
+    // 优先级相同的组按组名排序, 与组的内存地址无关
+    std::stable_sort(_sorted.begin(),_sorted.end(),[](Group* a,Group* b){
+        return a->_priority > b->_priority;
     });
+    notify(nullptr,nullptr,_version);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -861,25 +2309,33 @@ void Text::update_sorted()
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 Text::u8str Text::Group::u8(u8str src,u8str def) const
 {
-    auto iter = _map.find(src);
-    if(iter == _map.end())
+    auto item = find(src);
+    if(!item)
         return nullptr;
-    const auto& trs = iter->second;
+    const auto& trs = item->second;
     if(trs.empty()) // 译文为空则返回def
         return def;
     return trs.c_str();
 }
 
+// 冻结索引的指纹按utf8计算, 所以这里总是在树中查找
+template<class C>
+const Text::Group::item_t* Text::Group::find(std::basic_string_view<C> src) const
+{
+    auto iter = _map.find(ucs_key<C>{ src });
+    return iter == _map.end() ? nullptr : &*iter;
+}
+
 Text::u32str Text::Group::u32(u8str src,u8str def) const
 {
     static std::u32string u32str;
     static std::mutex mtx;
     std::lock_guard<std::mutex> lock(mtx);
 
-    auto iter = _map.find(src);
-    if(iter == _map.end())
+    auto item = find(src);
+    if(!item)
         return nullptr;
-    const auto& trs = iter->second;
+    const auto& trs = item->second;
     if(trs.empty()) // 译文为空则返回def
         u8to32(u32str, def);
     else
@@ -887,8 +2343,297 @@ Text::u32str Text::Group::u32(u8str src,u8str def) const
     return u32str.c_str();
 }
 
+void Text::Group::freeze()
+{
+    const auto n = _map.size();
+    // 每次冻结都使用新的随机密钥
+    _frozen.k0 = random_seed();
+    _frozen.k1 = random_seed();
+    std::vector<std::pair<uint64_t,const item_t*>> sorted;
+    sorted.reserve(n);
+    for(auto& it : _map)
+        sorted.push_back({ siphash(_frozen.k0,_frozen.k1,it.first.data(),it.first.size()),&it });
+    std::sort(sorted.begin(),sorted.end(),[](auto& a,auto& b){
+        return a.first < b.first;
+    });
+
+    auto& fps = _frozen.fps;
+    auto& items = _frozen.items;
+    fps.assign(n + 1,0);
+    items.assign(n + 1,nullptr);
+    // 中序遍历隐式二叉树, 依次填入有序的指纹
+    size_t i = 0;
+    auto fill = [&](auto& self,size_t k) -> void {
+        if(k > n) return;
+        self(self,2 * k);
+        fps[k] = sorted[i].first;
+        items[k] = sorted[i].second;
+        ++i;
+        self(self,2 * k + 1);
+    };
+    fill(fill,1);
+}
+
+bool Text::Group::frozen() const
+{
+    return !_frozen.fps.empty();
+}
+
+uint32_t Text::Group::priority() const
+{
+    return _priority;
+}
+
+Text::GroupHandle Text::Group::handle() const
+{
+    return _owner.handle;
+}
+
+const Text::Group::item_t* Text::Group::find(u8str src) const
+{
+    if(!src) return nullptr;
+    if(_frozen.fps.empty())
+    {
+        auto iter = _map.find(src);
+        return iter == _map.end() ? nullptr : &*iter;
+    }
+
+    const auto len = length(src);
+    const auto fp = siphash(_frozen.k0,_frozen.k1,src,len);
+    const auto fps = _frozen.fps.data();
+    const auto n = _frozen.fps.size() - 1;
+    // 无分支下降, 提前预取3层之后的子孙(一个缓存行放8个指纹)
+    size_t k = 1;
+    while(k <= n)
+    {
+        CKT_PREFETCH(fps + 8 * k);
+        k = 2 * k + (fps[k] < fp);
+    }
+    // 去掉末尾连续的右转, 得到第一个不小于fp的位置
+    while(k & 1) k >>= 1;
+    k >>= 1;
+
+    // 指纹可能冲突, 按中序依次比较指纹相同的项
+    while(k > 0 && fps[k] == fp)
+    {
+        auto item = _frozen.items[k];
+        if(item->first.size() == len && memcmp(item->first.data(),src,len) == 0)
+            return item;
+        if(2 * k + 1 <= n)
+        {
+            k = 2 * k + 1;
+            while(2 * k <= n) k = 2 * k;
+        }
+        else
+        {
+            while(k & 1) k >>= 1;
+            k >>= 1;
+        }
+    }
+    return nullptr;
+}
+
+bool Text::Group::collate(const char* locale)
+{
+    try {
+        _loc = locale ? std::locale(locale) : std::locale();
+    }
+    catch(const std::exception&) {
+        std::cerr << "Text::Group::collate: locale is not available:" << locale << std::endl;
+        return false;
+    }
+    for(auto& it : _map)
+        it.second.key = collate_key(_loc,it.second);
+    _collated = true;
+    return true;
+}
+
+const std::string* Text::Group::sortkey(u8str src) const
+{
+    if(!src || !_collated) return nullptr;
+    auto item = find(src);
+    return item ? item->second.key.str.get() : nullptr;
+}
+
+const Text::Group::Charset& Text::Group::charset() const
+{
+    std::lock_guard<std::mutex> lock(_lazy.mtx);
+    if(_charset_valid)
+        return _charset;
+
+    _charset = make_charset(_map);
+    _charset.shrink_to_fit();
+    _charset_valid = true;
+    return _charset;
+}
+
+size_t Text::Group::FoldHash::operator()(const std::string& str) const
+{
+    return (size_t)siphash(k0,k1,str.data(),str.size());
+}
+
+void Text::Group::fold()
+{
+    _folded.index = decltype(_folded.index)(_map.size(),FoldHash(random_seed(),random_seed()));
+    _folded.on = true;
+    for(auto& it : _map)
+        fold_insert(&it);
+}
+
+bool Text::Group::folded() const
+{
+    return _folded.on;
+}
+
+Text::u8str Text::Group::u8_fold(u8str src, u8str def) const
+{
+    if(!src) return nullptr;
+    const item_t* item = nullptr;
+    if(_folded.on)
+    {
+        std::string key;
+        u8fold(key,src);
+        item = find_folded(key);
+    }
+    else
+        item = find(src);
+    if(!item)
+        return nullptr;
+    if(item->second.empty())
+        return def;
+    return item->second.c_str();
+}
+
+const Text::Group::item_t* Text::Group::find_folded(const std::string& key) const
+{
+    const item_t* ret = nullptr;
+    auto range = _folded.index.equal_range(key);
+    for(auto i = range.first; i != range.second; ++i)
+    {
+        if(!ret || i->second->first < ret->first)
+            ret = i->second;
+    }
+    return ret;
+}
+
+void Text::Group::fold_insert(const item_t* item)
+{
+    std::string key;
+    u8fold(key,item->first.c_str(),(int)item->first.size());
+    _folded.index.emplace(std::move(key),item);
+}
+
+void Text::Group::fold_erase(const item_t* item)
+{
+    std::string key;
+    u8fold(key,item->first.c_str(),(int)item->first.size());
+    auto range = _folded.index.equal_range(key);
+    for(auto i = range.first; i != range.second; ++i)
+    {
+        if(i->second == item)
+        {
+            _folded.index.erase(i);
+            break;
+        }
+    }
+}
+
+uint64_t Text::Group::hash() const
+{
+    std::lock_guard<std::mutex> lock(_lazy.mtx);
+    if(_hash_valid)
+        return _hash;
+    _hash = content_hash(_prop,_map);
+    _hash_valid = true;
+    return _hash;
+}
+
+void Text::Group::invalidate()
+{
+    if(_owner.text)
+    {
+        _owner.text->touch();
+        _version = _owner.text->_version;
+    }
+    else
+        _version = ++g_version;
+    _charset_valid = false;
+    _hash_valid = false;
+    if(!_frozen.fps.empty())
+        _frozen = Frozen();
+}
+
+Text::Group::Owner& Text::Group::Owner::operator=(const Owner&)
+{
+    // 成员按声明顺序赋值, 到这里组的内容已经整体替换
+    if(text && group)
+    {
+        // 从源组复制来的内容哈希和码点仍然有效
+        const bool charset = group->_charset_valid;
+        const bool hash = group->_hash_valid;
+        group->changed();
+        group->_charset_valid = charset;
+        group->_hash_valid = hash;
+        // 优先级可能变化
+        text->update_sorted();
+    }
+    return *this;
+}
+
+void Text::Group::changed()
+{
+    invalidate();
+    // 所有翻译项都可能变化, 不再需要单独记录
+    _base = _version;
+    _removed.clear();
+    if(_owner.text)
+        _owner.text->notify(this,nullptr,_version);
+}
+
+void Text::Group::changed(const std::string& src)
+{
+    invalidate();
+    auto iter = _map.find(src);
+    entry_changed(src,iter == _map.end() ? nullptr : &iter->second);
+}
+
+void Text::Group::entry_changed(const std::string& src, Translation* entry)
+{
+    if(entry)
+    {
+        entry->version = _version;
+        if(!_removed.empty())
+            _removed.erase(src);
+    }
+    else if(_removed.size() < MAX_REMOVED)
+        _removed[src] = _version;
+    else
+    {
+        // 移除的原文过多, 视为所有翻译项都发生了变化
+        _base = _version;
+        _removed.clear();
+    }
+    if(_owner.text)
+        _owner.text->notify(this,&src,_version);
+}
+
+uint64_t Text::Group::version() const
+{
+    return _version;
+}
+
+uint64_t Text::Group::version(u8str src) const
+{
+    if(!src) return _base;
+    if(auto item = find(src))
+        return std::max(_base,item->second.version);
+    auto iter = _removed.find(src);
+    return iter == _removed.end() ? _base : std::max(_base,iter->second);
+}
+
 Text::Property &Text::Group::prop()
 {
+    _hash_valid = false;    // 属性可能被修改
     return _prop;
 }
 
@@ -907,16 +2652,34 @@ void Text::Group::clear()
     _prop.clear();
     _map.clear();
     _priority = 100;
+    _collated = false;
+    _folded = Folded();
+    _charset.clear();
+    changed();
 }
 
 void Text::Group::remove(u8str src)
 {
-    _map.erase(src);
+    if(!src) return;
+    auto iter = _map.find(src);
+    if(iter != _map.end())
+    {
+        if(_folded.on)
+            fold_erase(&*iter);
+        const std::string key = iter->first;
+        _map.erase(iter);
+        changed(key);
+    }
 }
 
 Text::Group::iterator Text::Group::remove(iterator it)
 {
-    return _map.erase(it);
+    if(_folded.on)
+        fold_erase(&*it);
+    const std::string key = it->first;
+    auto ret = _map.erase(it);
+    changed(key);
+    return ret;
 }
 
 Text::u8str Text::Group::set(u8str src, u8str trs)
@@ -927,11 +2690,41 @@ Text::u8str Text::Group::set(u8str src, u8str trs)
     const auto sz_trs = length(trs);
     if(sz_src < 1 || sz_src > L10KB || sz_trs > L10KB)
         return nullptr;
-    auto& it = _map[src];
+    auto ret = _map.try_emplace(src);
+    auto& it = ret.first->second;
     it = trs;
+    if(_collated)
+        it.key = collate_key(_loc,it);
+    if(_folded.on && ret.second)
+        fold_insert(&*ret.first);
+    invalidate();
+    entry_changed(ret.first->first,&it);
     return it.c_str();
 }
 
+size_t Text::Group::remove_if(const std::function<bool(const std::string&, const std::string&)>& pred)
+{
+    if(!pred) return 0;
+    std::vector<std::string> removed;
+    for(auto i = _map.begin(); i != _map.end();)
+    {
+        if(!pred(i->first,i->second))
+        {
+            ++i;
+            continue;
+        }
+        if(_folded.on)
+            fold_erase(&*i);
+        removed.push_back(std::move(_map.extract(i++).key()));  // 按迭代器移除, 均摊常数时间
+    }
+    if(removed.empty())
+        return 0;
+    invalidate();
+    for(auto& it : removed)
+        entry_changed(it,nullptr);
+    return removed.size();
+}
+
 Text::Group::iterator Text::Group::begin() const
 {
     return _map.begin();
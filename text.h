@@ -28,7 +28,17 @@
 
 #include <vector>
 #include <map>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <locale>
 #include <string>
+#include <string_view>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <iterator>
 #include <var.hpp>
 
 namespace ck
@@ -62,10 +72,67 @@ struct Text
         container _map;
     };
 
+    // 加载限制, 防止损坏或恶意的文件耗尽内存, 为0表示不限制
+    struct Limits
+    {
+        size_t max_bytes = 0;       // 解压后的最大字节数
+        size_t max_entries = 0;     // 翻译项总数
+        size_t max_groups = 0;      // 组个数
+        size_t max_memory = 0;      // 翻译项的估算内存占用
+    };
+
+    // 组句柄, 直接索引组表, 组被移除后句柄失效
+    struct GroupHandle
+    {
+        uint32_t index = UINT32_MAX;
+        uint32_t generation = 0;
+
+        inline bool operator==(const GroupHandle& o) const { return index == o.index && generation == o.generation; }
+        inline bool operator!=(const GroupHandle& o) const { return !(*this == o); }
+    };
+
+    // 驻留的原文编号, 由Text::intern返回
+    struct KeyId
+    {
+        uint32_t index = UINT32_MAX;
+
+        inline bool operator==(const KeyId& o) const { return index == o.index; }
+        inline bool operator!=(const KeyId& o) const { return index != o.index; }
+    };
+
     struct Group
     {
-        using container = std::map<std::string,std::string>;
+        // 译文, 用法同std::string, 另外记录该翻译项的排序键和版本号
+        // 每个翻译项比std::string多16字节, 排序键只在调用collate后分配
+        struct Translation : std::string
+        {
+            // 排序键, 复制时深复制
+            struct Key
+            {
+                std::unique_ptr<std::string> str;
+
+                Key() = default;
+                Key(const Key& o) : str(o.str ? new std::string(*o.str) : nullptr) {}
+                Key(Key&&) = default;
+                inline Key& operator=(const Key& o) { str.reset(o.str ? new std::string(*o.str) : nullptr); return *this; }
+                Key& operator=(Key&&) = default;
+                inline Key& operator=(std::string&& key) { str.reset(new std::string(std::move(key))); return *this; }
+            };
+
+            using std::string::string;
+            using std::string::operator=;
+            Translation() = default;
+            Translation(const std::string& str) : std::string(str) {}
+            Translation(std::string&& str) : std::string(std::move(str)) {}
+
+            Key key;                // 排序键, 见Group::collate
+            uint64_t version = 0;   // 最后一次单独变化的版本号
+        };
+        // std::less<>允许不构造std::string直接以其他类型的原文查找
+        using container = std::map<std::string,Translation,std::less<>>;
         using iterator = container::const_iterator;
+        // 码点区间列表, 每项为闭区间[first, second], 按码点升序且互不相邻
+        using Charset = std::vector<std::pair<char32_t,char32_t>>;
 
         // 获取译文
         // @def 译文不存在时的返回值
@@ -88,22 +155,258 @@ struct Text
         // @trs utf8编码译文
         // @return 插入成功返回插入的译文, 否则返回nullptr
         u8str set(u8str src, u8str trs);
+        // 在一次遍历中移除所有满足pred(原文, 译文)的翻译项
+        // @return 移除的个数
+        size_t remove_if(const std::function<bool(const std::string&, const std::string&)>& pred);
 
         iterator begin() const;
         iterator end() const;
         iterator remove(iterator);
+
+        // 冻结组, 为只读查询建立Eytzinger布局的原文指纹索引
+        // 冻结后查询只需少量缓存缺失, 任何修改都会自动解冻
+        void freeze();
+        bool frozen() const;
+
+        // 优先级, 值越大越先被查询
+        uint32_t priority() const;
+        // 组句柄, 通过Text::get(GroupHandle)访问组不需要比较组名
+        GroupHandle handle() const;
+
+        // 按locale的排序规则为每条译文生成排序键, 之后修改的译文会自动更新排序键
+        // 译文列表排序时只需对排序键做memcmp(或std::string比较)
+        // @locale locale名称(如"zh_CN.UTF-8"), 为nullptr则使用全局locale
+        // @return locale不可用时返回false
+        bool collate(const char* locale = nullptr);
+        // 获取译文的排序键, 原文不存在或未生成排序键时返回nullptr
+        const std::string* sortkey(u8str src) const;
+
+        // 建立以规范化(NFC)并折叠大小写的原文为键的索引, 之后修改组时自动更新索引
+        // 用u8_fold查询时忽略大小写和组合字符的写法, 只需一次哈希查找
+        void fold();
+        bool folded() const;
+        // 忽略大小写和组合字符的写法获取译文, 未建立索引时按原文精确查询
+        // 多个原文折叠后相同时返回按原文排序的第一个
+        // @return 同u8
+        u8str u8_fold(u8str src, u8str def = nullptr) const;
+
+        // 组的内容(属性和翻译项)哈希, 与文件格式和内存布局无关
+        // 文件中保存了哈希时直接使用, 否则在第一次调用时计算, 修改组后重新计算
+        // 可以在多个线程中同时调用
+        uint64_t hash() const;
+
+        // 版本号, 组的翻译项每次变化后都会增大
+        uint64_t version() const;
+        // 翻译项的版本号, 该原文的译文每次变化(包括添加和移除)后都会增大
+        // 没有单独变化过的原文返回整个组最后一次整体变化时的版本号
+        uint64_t version(u8str src) const;
+
+        // 组内所有译文用到的码点, 可用于预先生成字形图集
+        // 文件中保存了码点时直接使用, 否则在第一次调用时计算, 修改组后重新计算
+        // 可以在多个线程中同时调用
+        const Charset& charset() const;
+    private:
+        using item_t = container::value_type;
+        // 冻结索引, 按Eytzinger(BFS)顺序存放, 下标从1开始
+        // 索引指向本组的节点, 所以复制组时不复制索引
+        struct Frozen
+        {
+            std::vector<uint64_t> fps;          // 原文指纹, 以随机密钥计算, 防止恶意构造的冲突
+            std::vector<const item_t*> items;   // 与fps对应的翻译项
+            uint64_t k0 = 0, k1 = 0;            // 指纹密钥
+
+            Frozen() = default;
+            Frozen(const Frozen&) {}
+            Frozen(Frozen&&) = default;
+            inline Frozen& operator=(const Frozen&) { fps.clear(); items.clear(); return *this; }
+            Frozen& operator=(Frozen&&) = default;
+        };
+
+        // 折叠索引, 同冻结索引一样复制组时不复制
+        struct FoldHash
+        {
+            uint64_t k0, k1;    // 随机密钥, 防止恶意构造的冲突
+
+            FoldHash() : k0(0), k1(0) {}
+            FoldHash(uint64_t k0, uint64_t k1) : k0(k0), k1(k1) {}
+            size_t operator()(const std::string&) const;
+        };
+        struct Folded
+        {
+            std::unordered_multimap<std::string,const item_t*,FoldHash> index;
+            bool on = false;
+
+            Folded() = default;
+            Folded(const Folded&) {}
+            Folded(Folded&&) = default;
+            inline Folded& operator=(const Folded&) { index.clear(); on = false; return *this; }
+            Folded& operator=(Folded&&) = default;
+        };
+
+        const item_t* find(u8str src) const;
+        // 以折叠后的原文查找
+        const item_t* find_folded(const std::string& key) const;
+        void fold_insert(const item_t*);
+        void fold_erase(const item_t*);
+        // 以utf16/utf32(wchar_t按平台宽度)原文查找, 逐码点比较, 不转码
+        template<class C>
+        const item_t* find(std::basic_string_view<C> src) const;
+        // 使依赖翻译项的缓存失效并更新版本号
+        void invalidate();
+        // 组的内容整体发生了变化
+        void changed();
+        // 原文为src的翻译项发生了变化
+        void changed(const std::string& src);
+        // 记录翻译项的版本号并通知, 调用前需要先invalidate
+        // @entry 翻译项, 为nullptr表示已移除
+        void entry_changed(const std::string& src, Translation* entry);
     private:
         Property _prop;
         container _map;
+        Frozen _frozen;
+        Folded _folded;
+        std::locale _loc;           // 生成排序键使用的locale
+        bool _collated = false;     // 是否已生成排序键
+        mutable Charset _charset;   // 译文用到的码点
+        mutable bool _charset_valid = false;
+        mutable uint64_t _hash = 0;     // 内容哈希
+        mutable bool _hash_valid = false;
+        uint64_t _version = 0;      // 组的版本号
+        uint64_t _base = 0;         // 最后一次整体变化的版本号
+        // 之后移除的原文 -> 版本号, 数量超过上限时并入_base
+        std::map<std::string,uint64_t,std::less<>> _removed;
         uint32_t _priority = 100;  // 优先级
+        // 保护按需计算的_charset和_hash, 复制组时不复制
+        struct Lazy
+        {
+            std::mutex mtx;
+
+            Lazy() = default;
+            Lazy(const Lazy&) {}
+            inline Lazy& operator=(const Lazy&) { return *this; }
+        };
+        mutable Lazy _lazy;
+        // 组所属的Text和组句柄, 复制组时不复制
+        // 对Text中的组整体赋值时由此使Text的缓存失效, 见Owner::operator=
+        struct Owner
+        {
+            Text* text = nullptr;
+            Group* group = nullptr;     // 所在的组
+            GroupHandle handle;
+
+            Owner() = default;
+            Owner(const Owner&) {}
+            Owner& operator=(const Owner&);
+        };
+        Owner _owner;   // 必须是最后一个成员, 赋值时其他成员已经赋值完成
         template<class Rd>
-        friend bool load(Text&, Rd&);
+        friend bool load(Text&, Rd&, const Limits&);
         friend struct Text;
+        friend struct Image;
     };
 
     using container = std::map<std::string,Group>;
     using iterator = container::const_iterator;
 
+    // 访问统计, 原文 -> 访问次数
+    using Profile = std::map<std::string,uint32_t>;
+
+    // 保存选项
+    struct SaveOptions
+    {
+        bool compress = false;
+        // 访问统计, 不为空则按访问次数把热点组和热点翻译项排在前面,
+        // 加载时热点项会被连续分配, 减少查询时的缺页和缓存缺失
+        const Profile* profile = nullptr;
+        // 长度和个数使用8字节, 个数超出4字节的范围时总是使用8字节
+        bool wide = false;
+        // 为每个组保存译文用到的码点, 见Group::charset
+        bool charset = false;
+        // 保存数据的哈希和每个组的内容哈希, 见Group::hash
+        bool hash = false;
+        // 公共部分和每个组分别保存(压缩)为一块, 文件末尾保存块表
+        bool blocks = false;
+        // 增量保存, 隐含hash和blocks
+        // 目标文件的摘要与将要保存的内容相同时不写入文件, 否则内容未变的组直接复制旧文件中的块, 不重新生成和压缩
+        // 指定了profile时块的内容还取决于访问次数, 总是重新生成
+        bool incremental = false;
+        // 不保存被高优先级组遮盖的翻译项, 查询结果不变, 见Text::prune
+        bool prune = false;
+    };
+
+    // 执行器: 执行task(0)~task(n-1), 可以并行, 全部完成后返回
+    using Executor = std::function<void(size_t n, const std::function<void(size_t)>& task)>;
+    // 修改译文的函数, 参数为 组, 原文, 译文(可直接修改)
+    using Transform = std::function<void(const Group&, const std::string&, std::string&)>;
+    // 只读遍历的函数, 参数为 组, 原文, 译文
+    using Visitor = std::function<void(const Group&, const std::string&, const std::string&)>;
+
+    // 查询结果
+    struct Result
+    {
+        std::string_view str;           // 译文, 以\0结尾, 原文不存在时为空
+        const Group* group = nullptr;   // 提供译文的组, 原文不存在时为nullptr
+        uint32_t priority = 0;          // 组的优先级
+        bool empty = false;             // 原文存在但译文为空
+
+        inline explicit operator bool() const { return group != nullptr; }
+    };
+
+    // 有效目录的只读视图: 每个原文一项, 译文为查询时返回的那个
+    // 遍历时对各组的有序翻译项做多路归并, 不复制翻译项, 按原文升序产生
+    // 修改Text后视图和迭代器失效
+    struct Effective
+    {
+        struct Entry
+        {
+            const std::string* src = nullptr;
+            const std::string* trs = nullptr;
+            const Group* group = nullptr;   // 提供译文的组
+        };
+
+        class iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Entry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Entry*;
+            using reference = const Entry&;
+
+            iterator() = default;
+            inline reference operator*() const { return _entry; }
+            inline pointer operator->() const { return &_entry; }
+            iterator& operator++();
+            inline iterator operator++(int) { auto ret = *this; ++*this; return ret; }
+            inline bool operator==(const iterator& o) const { return _entry.src == o._entry.src; }
+            inline bool operator!=(const iterator& o) const { return !(*this == o); }
+        private:
+            friend struct Effective;
+            friend struct Text;
+            // 每组当前的位置, rank为组在查询顺序中的位置
+            struct Cursor
+            {
+                Group::iterator cur;
+                Group::iterator end;
+                const Group* group;
+                uint32_t rank;
+            };
+            // 最小堆的比较函数
+            static bool greater(const Cursor& a, const Cursor& b);
+            // 取出最小的原文, 跳过其他组中相同的原文
+            void next();
+        private:
+            std::vector<Cursor> _heap;  // 最小堆, 原文相同时rank小的在前
+            Entry _entry;               // 当前项, 结束时src为nullptr
+        };
+
+        iterator begin() const;
+        iterator end() const;
+    private:
+        friend struct Text;
+        const Text* _text = nullptr;
+    };
+
     Text();
     Text(const Text&) = delete;
 
@@ -126,11 +429,21 @@ struct Text
     // @param len 输入字符串的长度, 为0则按\0结尾计算 
     static void CKT_CALL u32to16(std::u16string& out, u32str in, int len = 0);
 
+    // 规范化(NFC)并折叠大小写, 用于忽略大小写和组合字符写法的比较
+    // 只处理拉丁, 希腊, 西里尔字母和谚文音节
+    // @param len 输入字符串的长度, 为0则按\0结尾计算
+    static void CKT_CALL u8fold(std::string& out, u8str in, int len = 0);
+
     // 打开ckt文件
     bool open(const char*);
+    // 打开ckt文件, 数据超出限制时停止加载并返回false
+    bool open(const char*, const Limits&);
     // 从内存加载ckt数据
     bool load(const uint8_t* buf, size_t size);
+    // 从内存加载ckt数据, 数据超出限制时停止加载并返回false
+    bool load(const uint8_t* buf, size_t size, const Limits&);
     bool save(const char*, bool compress = false);
+    bool save(const char*, const SaveOptions&);
 
     // 获取第一个匹配的译文
     // @def 译文不存在时的返回值
@@ -142,19 +455,115 @@ struct Text
     // @return utf8译文 或 nullptr(原文不存在) 或 def(译文不存在)
     u32str u32(u8str src,u8str def = nullptr) const;
 
+    // 获取第一个匹配的译文及其长度, 来源组和优先级, u8/u32也通过它查询
+    Result lookup(u8str src) const;
+
+    // 同u8, 但以src的地址为键把结果缓存在当前线程中, 重复查询时不比较字符串
+    // Text的任何修改都会使缓存失效
+    // 只能用于地址和内容在进程生命期内都不变的原文, 如字符串字面量
+    u8str u8_literal(u8str src, u8str def = nullptr) const;
+
+    // 以utf16/utf32原文查询, 与utf8原文逐码点比较, 不需要先转码
+    // wchar_t在Windows上按utf16处理, 其他平台按utf32处理
+    Result lookup(std::u16string_view src) const;
+    Result lookup(std::u32string_view src) const;
+    Result lookup(std::wstring_view src) const;
+    // @return 同u8(u8str)
+    u8str u8(std::u16string_view src, u8str def = nullptr) const;
+    u8str u8(std::u32string_view src, u8str def = nullptr) const;
+    u8str u8(std::wstring_view src, u8str def = nullptr) const;
+
+    // 为所有组建立折叠索引, 见Group::fold
+    void fold();
+    // 忽略大小写和组合字符的写法查询, 原文只折叠一次, 每组一次哈希查找
+    // 未建立索引的组按原文精确查询
+    Result lookup_fold(u8str src) const;
+    // @return 同u8
+    u8str u8_fold(u8str src, u8str def = nullptr) const;
+
+    // 驻留原文, 同一原文总是返回相同的编号
+    // 编号在Text的生命期内一直有效, clear/open后在下次查询时重新解析
+    KeyId intern(u8str src);
+    // 获取驻留原文的第一个匹配的译文, 版本号未变化时直接返回上次解析的结果
+    // @return 同u8
+    u8str u8(KeyId id, u8str def = nullptr) const;
+    // 同lookup(u8str)
+    Result lookup(KeyId id) const;
+
+    // 版本号, Text或其中的组每次修改后都会变化, 不同Text的版本号也不相同
+    uint64_t version() const;
+    // 原文的版本号, 查询该原文的结果可能变化时(翻译项变化, 组的增减和优先级变化)都会增大
+    // 版本号不变时查询结果一定不变, 需遍历各组, 每组一次原文查找, O(log n)
+    uint64_t version(u8str src) const;
+
+    // 变化通知, 在修改Text的线程中修改完成后调用
+    // @group 变化的组, 为nullptr表示组的增减, 重命名或优先级变化, 所有查询结果都可能变化
+    // @src 变化的原文, 为nullptr表示组的所有翻译项都可能变化
+    using Listener = std::function<void(const Group* group, const std::string* src, uint64_t version)>;
+    // 设置变化通知, 为空则取消
+    void listen(const Listener& fn);
+
     Property& prop();
     const Property& prop() const;
 
+    // 开启访问采样, 每次u8/u32查询以1/rate的概率记录命中的原文
+    // @rate 平均采样间隔, 为0则关闭采样
+    void sample(uint32_t rate);
+    // 获取采样得到的访问统计
+    Profile profile() const;
+    // 清空访问统计
+    void reset_profile();
+    // 保存访问统计到文件
+    static bool save_profile(const char*, const Profile&);
+    // 从文件读取访问统计, 与out中已有的统计累加
+    static bool load_profile(const char*, Profile& out);
+
     // 获取组
     // @group 组名, 为nullptr则返回无名的默认组
     Group* get(const char* group = nullptr);
     const Group* get(const char* group = nullptr) const;
+    // 通过句柄获取组, 句柄已失效时返回nullptr
+    Group* get(GroupHandle);
+    const Group* get(GroupHandle) const;
+    // 获取组句柄, 组不存在时返回无效句柄
+    GroupHandle handle(const char* group = nullptr) const;
+
+    // 默认执行器, 在hardware_concurrency个线程上执行, 任务抛出的第一个异常在全部完成后重新抛出
+    static void CKT_CALL parallel(size_t n, const std::function<void(size_t)>& task);
+
+    // 把所有翻译项分块后交给执行器, 并行修改译文
+    // 译文原地修改, 不会重新插入, fn在多个线程中被同时调用, 不能修改Text
+    void transform(const Transform& fn, const Executor& executor = parallel);
+    // 把所有翻译项分块后交给执行器, 并行只读遍历
+    void for_each_parallel(const Visitor& fn, const Executor& executor = parallel) const;
+
+    // 冻结所有组, 见Group::freeze
+    void freeze();
+
+    // 为所有组生成译文排序键, 见Group::collate
+    bool collate(const char* locale = nullptr);
+    // 获取第一个匹配的译文的排序键
+    // @return 排序键 或 nullptr(原文不存在或未生成排序键)
+    const std::string* sortkey(u8str src) const;
+
+    // 获取有效目录的视图, 见Effective
+    Effective effective() const;
+
+    // 移除被遮盖的翻译项, 即已存在于更高优先级组(按查询顺序)中的原文, 查询结果不变
+    // @return 移除的个数
+    size_t prune();
+    // 把所有组合并为默认组, 每个原文只保留查询时的第一个译文, 其他组被移除
+    // 合并后每次查询只需查找一个组, 默认组的属性保持不变
+    void flatten();
 
     // 重命名组
     bool rename(const char* oldName,const char* newName);
     bool empty() const;
     void clear();
     void remove(const char* group);
+    // 在一次遍历中移除所有满足pred(组名, 组)的组, 默认组只清空翻译项
+    // @return 移除的组数
+    size_t remove_groups_if(const std::function<bool(const std::string&, const Group&)>& pred);
     // 插入组
     // @return 返回插入组的指针, 失败返回nullptr
     Group* insert(const char* group, const Property& prop = {});
@@ -164,12 +573,50 @@ struct Text
     iterator remove(iterator);
 private:
     void update_sorted();
+    void record(u8str src) const;
+    // 收集所有被遮盖的翻译项
+    void shadowed(std::unordered_set<const Group::container::value_type*>& out) const;
+    template<class C>
+    Result lookup_ucs(std::basic_string_view<C> src) const;
+    // 更新版本号
+    void touch();
+    void notify(const Group* group, const std::string* src, uint64_t version) const;
+    // 为加入容器的组分配句柄
+    void attach(Group&);
+    // 回收被移除的组的句柄
+    void detach(const Group&);
 private:
     template<class Rd>
-    friend bool load(Text&, Rd&);
+    friend bool load(Text&, Rd&, const Limits&);
+    friend struct Image;
     Property _prop;
     container _map;
     std::vector<Group*> _sorted;
+    // 组表, 句柄的index指向这里
+    struct Slot
+    {
+        Group* group;
+        uint32_t generation;
+    };
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _free;    // 空闲的组表位置
+    uint64_t _version = 0;
+    uint64_t _layout = 0;       // 组的增减, 重命名或优先级最后一次变化的版本号
+    Listener _listener;
+    // 驻留的原文及其解析结果, 版本号与_version不同时需要重新解析
+    struct Interned
+    {
+        std::string src;
+        mutable std::atomic<uint64_t> version { 0 };
+        mutable Result result;
+    };
+    std::deque<Interned> _interned;
+    std::unordered_map<std::string_view,uint32_t> _interned_index;
+    mutable std::mutex _mtx_interned;
+    std::atomic<uint32_t> _rate { 0 };  // 采样间隔
+    // 访问统计, 每个线程一份缓冲, 读取时合并
+    struct Samples;
+    std::shared_ptr<Samples> _samples;
 };
 
 }